@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+#include "random.hpp"
+#include "simd_math.hpp"
+
+namespace calc {
+
+// Rows evaluated together by `run_batch`. Every instruction sweeps a whole
+// block before the next one starts, so each builtin runs as a tight loop.
+constexpr std::size_t batch_block = 256;
+
+namespace detail {
+
+template <Op op, class F>
+auto unary_block(const F* a, F* out, std::size_t n) -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = apply(op, a[i]);
+    }
+}
+
+template <Op op, class F>
+auto binary_block(const F* a, const F* b, F* out, std::size_t n) -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = apply(op, a[i], b[i]);
+    }
+}
+
+// Both sides are already computed, so this compiles to a blend instead of a
+// branch per row.
+template <class F>
+auto select_block(const F* condition, const F* then, const F* otherwise,
+                  F* out, std::size_t n) -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = select(condition[i], then[i], otherwise[i]);
+    }
+}
+
+template <class F>
+auto fma_block(const F* a, const F* b, const F* c, F* out, std::size_t n)
+    -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = std::fma(a[i], b[i], c[i]);
+    }
+}
+
+// Row `i` draws the numbers of sample `first.index + i`. The generator is a
+// pure function of the counter with no state carried between rows, so these
+// loops vectorize.
+template <class F>
+auto rand_block(Sample first, std::uint32_t stream, F* out, std::size_t n)
+    -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = uniform<F>({first.seed, first.index + i}, stream);
+    }
+}
+
+template <class F>
+auto normal_block(Sample first, std::uint32_t stream, const F* mu,
+                  const F* sigma, F* out, std::size_t n) -> void {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = normal({first.seed, first.index + i}, stream, mu[i], sigma[i]);
+    }
+}
+
+template <class F>
+auto apply_block(Op op, const F* a, F* out, std::size_t n, MathMode mode)
+    -> void {
+#ifdef CALC_SIMD
+    if constexpr (std::is_same_v<F, double>) {
+        if (mode == MathMode::Fast) {
+            switch (op) {
+                case Op::Exp:
+                    return simd::exp(a, out, n);
+                case Op::Ln:
+                    return simd::ln(a, out, n);
+                case Op::Sin:
+                    return simd::sin(a, out, n);
+                case Op::Cos:
+                    return simd::cos(a, out, n);
+                case Op::Tanh:
+                    return simd::tanh(a, out, n);
+                default:
+                    break;
+            }
+        }
+    }
+#endif
+
+    switch (op) {
+        case Op::Sqrt:
+            return unary_block<Op::Sqrt>(a, out, n);
+        case Op::Cbrt:
+            return unary_block<Op::Cbrt>(a, out, n);
+        case Op::Abs:
+            return unary_block<Op::Abs>(a, out, n);
+        case Op::Ln:
+            return unary_block<Op::Ln>(a, out, n);
+        case Op::Lg:
+            return unary_block<Op::Lg>(a, out, n);
+        case Op::Exp:
+            return unary_block<Op::Exp>(a, out, n);
+        case Op::Ceil:
+            return unary_block<Op::Ceil>(a, out, n);
+        case Op::Floor:
+            return unary_block<Op::Floor>(a, out, n);
+        case Op::Round:
+            return unary_block<Op::Round>(a, out, n);
+        case Op::Trunc:
+            return unary_block<Op::Trunc>(a, out, n);
+        case Op::Sin:
+            return unary_block<Op::Sin>(a, out, n);
+        case Op::Asin:
+            return unary_block<Op::Asin>(a, out, n);
+        case Op::Sinh:
+            return unary_block<Op::Sinh>(a, out, n);
+        case Op::Asinh:
+            return unary_block<Op::Asinh>(a, out, n);
+        case Op::Cos:
+            return unary_block<Op::Cos>(a, out, n);
+        case Op::Acos:
+            return unary_block<Op::Acos>(a, out, n);
+        case Op::Cosh:
+            return unary_block<Op::Cosh>(a, out, n);
+        case Op::Acosh:
+            return unary_block<Op::Acosh>(a, out, n);
+        case Op::Tan:
+            return unary_block<Op::Tan>(a, out, n);
+        case Op::Atan:
+            return unary_block<Op::Atan>(a, out, n);
+        case Op::Tanh:
+            return unary_block<Op::Tanh>(a, out, n);
+        case Op::Atanh:
+            return unary_block<Op::Atanh>(a, out, n);
+        default:
+            break;
+    }
+}
+
+template <class F>
+auto apply_block(Op op, const F* a, const F* b, F* out, std::size_t n,
+                 MathMode mode) -> void {
+#ifdef CALC_SIMD
+    if constexpr (std::is_same_v<F, double>) {
+        if (mode == MathMode::Fast and op == Op::Pow) {
+            return simd::pow(a, b, out, n);
+        }
+    }
+#endif
+
+    switch (op) {
+        case Op::Add:
+            return binary_block<Op::Add>(a, b, out, n);
+        case Op::Sub:
+            return binary_block<Op::Sub>(a, b, out, n);
+        case Op::Mul:
+            return binary_block<Op::Mul>(a, b, out, n);
+        case Op::Div:
+            return binary_block<Op::Div>(a, b, out, n);
+        case Op::Mod:
+            return binary_block<Op::Mod>(a, b, out, n);
+        case Op::Pow:
+            return binary_block<Op::Pow>(a, b, out, n);
+        case Op::LessThan:
+            return binary_block<Op::LessThan>(a, b, out, n);
+        case Op::LessEquals:
+            return binary_block<Op::LessEquals>(a, b, out, n);
+        case Op::GreaterThan:
+            return binary_block<Op::GreaterThan>(a, b, out, n);
+        case Op::GreaterEquals:
+            return binary_block<Op::GreaterEquals>(a, b, out, n);
+        case Op::Equals:
+            return binary_block<Op::Equals>(a, b, out, n);
+        case Op::Min:
+            return binary_block<Op::Min>(a, b, out, n);
+        case Op::Max:
+            return binary_block<Op::Max>(a, b, out, n);
+        case Op::Log:
+            return binary_block<Op::Log>(a, b, out, n);
+        case Op::Gcd:
+            return binary_block<Op::Gcd>(a, b, out, n);
+        case Op::Lcm:
+            return binary_block<Op::Lcm>(a, b, out, n);
+        case Op::And:
+            return binary_block<Op::And>(a, b, out, n);
+        case Op::Or:
+            return binary_block<Op::Or>(a, b, out, n);
+        case Op::Xor:
+            return binary_block<Op::Xor>(a, b, out, n);
+        default:
+            break;
+    }
+}
+
+}  // namespace detail
+
+// Evaluates the program for `rows` rows. `columns[slot]` holds the values of
+// the variable in that slot for every row, results are written to `out`.
+// Slots the program assigns before reading need no column, and loads after
+// an assignment read the assigned values. Jumps are ignored: every operand of
+// `and`, `or` and `if` is evaluated for the whole block and the results are
+// selected per row, so assignments inside them are rejected. Instructions
+// that depend on no variable are evaluated for the first block only. Row `i`
+// is sample `first.index + i` of the random builtins.
+template <class F>
+auto run_batch(const Program<F>& program, std::span<const F* const> columns,
+               F* out, std::size_t rows, MathMode mode = MathMode::Exact,
+               Sample first = {}) -> std::optional<bool> {
+    ASSERT(columns.size() >= program.names.size(),
+           "Expected a column for each of " << program.names.size()
+                                            << " variables");
+
+    const auto needed = detail::inputs(program);
+    for (std::size_t slot = 0; slot < needed.size(); ++slot) {
+        ASSERT(not needed[slot] or columns[slot],
+               "No column for variable " << program.names[slot]);
+    }
+
+    std::uint32_t reach = 0;
+    for (std::uint32_t i = 0; i < program.code.size(); ++i) {
+        const auto& instruction = program.code[i];
+        if (detail::is_jump(instruction.op)) {
+            reach = std::max(reach, instruction.b);
+        }
+        ASSERT(instruction.op != Op::Store or i >= reach,
+               "Assignment to " << program.names[instruction.a]
+                                << " inside `and`, `or` or `if` is not "
+                                   "supported in batch mode");
+    }
+
+    const auto size = program.code.size();
+    std::vector<F> values(size * batch_block);
+    std::vector<const F*> operands(size);
+    // rows of the current block held by each slot, a column until the
+    // program assigns the slot
+    std::vector<const F*> slots(program.names.size());
+
+    std::vector<bool> invariant(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        const auto& instruction = program.code[i];
+        invariant[i] = instruction.op != Op::Load and
+                       instruction.op != Op::Store and
+                       not detail::is_jump(instruction.op) and
+                       not detail::is_random(instruction.op);
+        detail::for_each_operand(instruction, [&](std::uint32_t operand) {
+            invariant[i] = invariant[i] and invariant[operand];
+        });
+    }
+
+    for (std::size_t row = 0; row < rows; row += batch_block) {
+        const auto n = std::min(batch_block, rows - row);
+
+        for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+            slots[slot] = columns[slot] ? columns[slot] + row : nullptr;
+        }
+
+        for (std::size_t i = 0; i < size; ++i) {
+            const auto& instruction = program.code[i];
+            auto* result = values.data() + i * batch_block;
+
+            if (row != 0 and invariant[i]) {
+                continue;
+            }
+            // the first block computes invariants for every row of a block
+            const auto width = invariant[i] ? batch_block : n;
+
+            switch (instruction.op) {
+                case Op::Const:
+                    std::fill_n(result, batch_block, instruction.value);
+                    operands[i] = result;
+                    break;
+                case Op::Load:
+                    operands[i] = slots[instruction.a];
+                    break;
+                case Op::Store:
+                    operands[i] = slots[instruction.a] =
+                        operands[instruction.b];
+                    break;
+                case Op::Jump:
+                case Op::JumpIf:
+                case Op::JumpUnless:
+                    break;
+                case Op::Select:
+                    detail::select_block(
+                        operands[instruction.a], operands[instruction.b],
+                        operands[instruction.c], result, width);
+                    operands[i] = result;
+                    break;
+                case Op::Fma:
+                    detail::fma_block(operands[instruction.a],
+                                      operands[instruction.b],
+                                      operands[instruction.c], result, width);
+                    operands[i] = result;
+                    break;
+                case Op::Rand:
+                    detail::rand_block({first.seed, first.index + row},
+                                       instruction.c, result, n);
+                    operands[i] = result;
+                    break;
+                case Op::Normal:
+                    detail::normal_block({first.seed, first.index + row},
+                                         instruction.c, operands[instruction.a],
+                                         operands[instruction.b], result, n);
+                    operands[i] = result;
+                    break;
+                default:
+                    if (detail::is_unary(instruction.op)) {
+                        detail::apply_block(instruction.op,
+                                            operands[instruction.a], result,
+                                            width, mode);
+                    } else {
+                        detail::apply_block(
+                            instruction.op, operands[instruction.a],
+                            operands[instruction.b], result, width, mode);
+                    }
+                    operands[i] = result;
+                    break;
+            }
+        }
+
+        std::copy_n(operands[program.result], n, out + row);
+    }
+
+    return true;
+}
+
+}  // namespace calc
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+namespace detail {
+
+constexpr auto cpp_function(Op op) -> std::string_view {
+    switch (op) {
+        case Op::Sqrt:
+            return "std::sqrt";
+        case Op::Cbrt:
+            return "std::cbrt";
+        case Op::Abs:
+            return "std::fabs";
+        case Op::Ln:
+            return "std::log";
+        case Op::Lg:
+            return "std::log10";
+        case Op::Exp:
+            return "std::exp";
+        case Op::Ceil:
+            return "std::ceil";
+        case Op::Floor:
+            return "std::floor";
+        case Op::Round:
+            return "std::round";
+        case Op::Trunc:
+            return "std::trunc";
+        case Op::Sin:
+            return "std::sin";
+        case Op::Asin:
+            return "std::asin";
+        case Op::Sinh:
+            return "std::sinh";
+        case Op::Asinh:
+            return "std::asinh";
+        case Op::Cos:
+            return "std::cos";
+        case Op::Acos:
+            return "std::acos";
+        case Op::Cosh:
+            return "std::cosh";
+        case Op::Acosh:
+            return "std::acosh";
+        case Op::Tan:
+            return "std::tan";
+        case Op::Atan:
+            return "std::atan";
+        case Op::Tanh:
+            return "std::tanh";
+        case Op::Atanh:
+            return "std::atanh";
+        case Op::Mod:
+            return "std::fmod";
+        case Op::Pow:
+            return "std::pow";
+        case Op::Min:
+            return "std::min";
+        case Op::Max:
+            return "std::max";
+        case Op::Fma:
+            return "std::fma";
+        default:
+            return {};
+    }
+}
+
+constexpr auto cpp_operator(Op op) -> std::string_view {
+    switch (op) {
+        case Op::Add:
+            return " + ";
+        case Op::Sub:
+            return " - ";
+        case Op::Mul:
+            return " * ";
+        case Op::Div:
+            return " / ";
+        case Op::LessThan:
+            return " < ";
+        case Op::LessEquals:
+            return " <= ";
+        case Op::GreaterThan:
+            return " > ";
+        case Op::GreaterEquals:
+            return " >= ";
+        case Op::And:
+            return " && ";
+        case Op::Or:
+            return " || ";
+        default:
+            return {};
+    }
+}
+
+inline auto cpp_literal(double value) -> std::string {
+    if (std::isnan(value)) {
+        return "NAN";
+    }
+    if (std::isinf(value)) {
+        return value < 0 ? "-HUGE_VAL" : "HUGE_VAL";
+    }
+
+    char buffer[64];
+    std::string literal(buffer,
+                        std::to_chars(buffer, buffer + sizeof(buffer), value)
+                            .ptr);
+
+    if (literal.find_first_of(".e") == std::string::npos) {
+        literal += ".0";
+    }
+    return literal;
+}
+
+// Writes the body of a lowered program as structured C++. Jumps become
+// `if` statements around the instructions they skip. Values computed in a
+// branch are declared up front, the others where they are computed.
+class CppWriter {
+   public:
+    CppWriter(std::ostream& os, const Program<double>& program)
+        : _os(os), _program(program), _local(program.names.size()) {
+        std::vector<bool> loaded(program.names.size());
+
+        for (auto&& instruction : program.code) {
+            if (instruction.op == Op::Load) {
+                loaded[instruction.a] = true;
+            } else if (instruction.op == Op::Store) {
+                _local[instruction.a] = true;
+            }
+        }
+        for (std::size_t slot = 0; slot < _local.size(); ++slot) {
+            _local[slot] = _local[slot] and loaded[slot];
+        }
+    }
+
+    auto write() -> void {
+        for (std::size_t slot = 0; slot < _local.size(); ++slot) {
+            if (_local[slot]) {
+                _os << "    double s" << slot << " = vars[" << slot << "];\n";
+            }
+        }
+
+        declare(0, _program.code.size(), false);
+        block(0, _program.code.size(), 1, false);
+
+        _os << "    return v" << _program.result << ";\n";
+    }
+
+   private:
+    // Declares the values computed in a branch inside [begin, end).
+    auto declare(std::size_t begin, std::size_t end, bool branch) -> void {
+        for (auto i = begin; i < end; ++i) {
+            const auto& instruction = _program.code[i];
+
+            if (instruction.op == Op::JumpIf or
+                instruction.op == Op::JumpUnless) {
+                const auto skip = instruction.b;
+                const auto& last = _program.code[skip - 1];
+
+                if (last.op == Op::Jump) {
+                    declare(i + 1, skip - 1, true);
+                    declare(skip, last.b, true);
+                    i = last.b - 1;
+                } else {
+                    declare(i + 1, skip, true);
+                    i = skip - 1;
+                }
+            } else if (branch) {
+                _os << "    double v" << i << ";\n";
+            }
+        }
+    }
+
+    auto block(std::size_t begin, std::size_t end, int depth, bool branch)
+        -> void {
+        const std::string indent(4 * static_cast<std::size_t>(depth), ' ');
+
+        for (auto i = begin; i < end; ++i) {
+            const auto& instruction = _program.code[i];
+
+            if (instruction.op == Op::JumpIf or
+                instruction.op == Op::JumpUnless) {
+                const auto skip = instruction.b;
+                const auto negate = instruction.op == Op::JumpIf;
+
+                _os << indent << "if (" << (negate ? "!" : "")
+                    << "static_cast<int>(v" << instruction.a << ")) {\n";
+
+                // `if` jumps over its first branch to the second one
+                const auto& last = _program.code[skip - 1];
+                if (last.op == Op::Jump) {
+                    block(i + 1, skip - 1, depth + 1, true);
+                    _os << indent << "} else {\n";
+                    block(skip, last.b, depth + 1, true);
+                    i = last.b - 1;
+                } else {
+                    block(i + 1, skip, depth + 1, true);
+                    i = skip - 1;
+                }
+
+                _os << indent << "}\n";
+                continue;
+            }
+
+            _os << indent << (branch ? "" : "const double ") << 'v' << i
+                << " = ";
+            value(instruction);
+            _os << ";\n";
+        }
+    }
+
+    auto value(const Instruction<double>& instruction) -> void {
+        const auto op = instruction.op;
+        const auto a = instruction.a, b = instruction.b, c = instruction.c;
+
+        if (op == Op::Const) {
+            _os << cpp_literal(instruction.value);
+        } else if (op == Op::Load) {
+            if (_local[a]) {
+                _os << 's' << a;
+            } else {
+                _os << "vars[" << a << ']';
+            }
+        } else if (op == Op::Store) {
+            if (_local[a]) {
+                _os << 's' << a << " = ";
+            }
+            _os << 'v' << b;
+        } else if (op == Op::Select) {
+            _os << "static_cast<int>(v" << a << ") ? v" << b << " : v" << c;
+        } else if (op == Op::Equals) {
+            _os << "static_cast<double>(std::abs(v" << a << " - v" << b
+                << ") <= 1e-40)";
+        } else if (op == Op::Log) {
+            _os << "std::log(v" << a << ") / std::log(v" << b << ')';
+        } else if (op == Op::Gcd or op == Op::Lcm) {
+            _os << "static_cast<double>(std::"
+                << (op == Op::Gcd ? "gcd" : "lcm") << "(static_cast<int>(v"
+                << a << "), static_cast<int>(v" << b << ")))";
+        } else if (op == Op::Xor) {
+            _os << "static_cast<double>(static_cast<int>(v" << a
+                << ") ^ static_cast<int>(v" << b << "))";
+        } else if (op == Op::And or op == Op::Or) {
+            _os << "static_cast<double>(static_cast<bool>(static_cast<int>(v"
+                << a << "))" << cpp_operator(op)
+                << "static_cast<bool>(static_cast<int>(v" << b << ")))";
+        } else if (const auto infix = cpp_operator(op); not infix.empty()) {
+            if (op >= Op::LessThan) {
+                _os << "static_cast<double>(v" << a << infix << 'v' << b
+                    << ')';
+            } else {
+                _os << 'v' << a << infix << 'v' << b;
+            }
+        } else {
+            _os << cpp_function(op) << "(v" << a;
+            if (is_binary(op) or is_ternary(op)) {
+                _os << ", v" << b;
+            }
+            if (is_ternary(op)) {
+                _os << ", v" << c;
+            }
+            _os << ')';
+        }
+    }
+
+    std::ostream& _os;
+    const Program<double>& _program;
+    std::vector<bool> _local;
+};
+
+// Names a generated function cannot take: keywords and alternative tokens,
+// the namespace and macros <cmath> brings along, and `main`.
+constexpr std::array<std::string_view, 103> reserved_names = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+    "bool", "break", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
+    "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+    "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype",
+    "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto",
+    "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept",
+    "not", "not_eq", "nullptr", "operator", "or", "or_eq", "private",
+    "protected", "public", "register", "reinterpret_cast", "requires", "return",
+    "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+    "struct", "switch", "template", "this", "thread_local", "throw", "true",
+    "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+    "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq", "std",
+    "main", "errno", "math_errhandling", "HUGE_VAL", "HUGE_VALF", "HUGE_VALL",
+    "INFINITY", "NAN", "MATH_ERRNO", "MATH_ERREXCEPT",
+};
+
+inline auto is_identifier(std::string_view name) -> bool {
+    // a leading underscore or a double one is reserved to the implementation,
+    // so are the FP_ macros of <cmath>
+    if (name.empty() or std::isdigit(static_cast<unsigned char>(name[0])) or
+        name.starts_with('_') or name.starts_with("FP_") or
+        name.find("__") != std::string_view::npos or
+        std::ranges::find(reserved_names, name) != reserved_names.end()) {
+        return false;
+    }
+    for (const auto ch : name) {
+        if (not std::isalnum(static_cast<unsigned char>(ch)) and ch != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace detail
+
+// Writes a self-contained header defining `inline double name(const double*
+// vars)`, which computes the program with `vars[i]` holding the variable in
+// slot i. Constant subexpressions are folded first, the operands `and`, `or`
+// and `if` skip stay behind branches.
+inline auto emit_cpp(std::ostream& os, const Program<double>& program,
+                     std::string_view name) -> std::optional<bool> {
+    ASSERT(detail::is_identifier(name),
+           "`" << name << "` is not a valid function name");
+    ASSERT(std::ranges::none_of(program.code,
+                                [](auto&& instruction) {
+                                    return detail::is_random(instruction.op);
+                                }),
+           "Random builtins cannot be exported");
+
+    const auto folded = detail::Lowering(detail::fold(
+        detail::strip(program),
+        [](std::string_view) -> std::optional<double> { return {}; }))();
+
+    os << "#pragma once\n\n"
+       << "#include <algorithm>\n"
+       << "#include <cmath>\n"
+       << "#include <numeric>\n\n";
+
+    for (std::size_t slot = 0; slot < folded.names.size(); ++slot) {
+        os << (slot == 0 ? "// " : ", ") << "vars[" << slot
+           << "] = " << folded.names[slot];
+    }
+    if (not folded.names.empty()) {
+        os << '\n';
+    }
+
+    os << "inline double " << name << "(const double* vars) {\n";
+    if (folded.names.empty()) {
+        os << "    static_cast<void>(vars);\n";
+    }
+    detail::CppWriter(os, folded).write();
+    os << "}\n";
+
+    return true;
+}
+
+}  // namespace calc
@@ -0,0 +1,354 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+#include "evaluator.hpp"
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+// Read only mapping of a whole file.
+class MappedFile {
+   public:
+    static auto open(const std::string& path) -> std::optional<MappedFile> {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status {};
+
+        if (fd < 0 or ::fstat(fd, &status) < 0) {
+            std::cerr << "Cannot open " << path << ": " << std::strerror(errno)
+                      << '\n';
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return std::nullopt;
+        }
+
+        const auto size = static_cast<std::size_t>(status.st_size);
+        void* data = nullptr;
+
+        if (size > 0) {
+            data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            std::cerr << "Cannot map " << path << ": " << std::strerror(errno)
+                      << '\n';
+            return std::nullopt;
+        }
+        if (data) {
+            ::madvise(data, size, MADV_SEQUENTIAL);
+        }
+
+        return MappedFile(static_cast<const char*>(data), size);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : _data(std::exchange(other._data, nullptr)),
+          _size(std::exchange(other._size, 0)),
+          _released(other._released) {}
+
+    MappedFile(const MappedFile&) = delete;
+    auto operator=(const MappedFile&) -> MappedFile& = delete;
+    auto operator=(MappedFile&&) -> MappedFile& = delete;
+
+    ~MappedFile() {
+        if (_data) {
+            ::munmap(const_cast<char*>(_data), _size);
+        }
+    }
+
+    auto data() const -> const char* { return _data; }
+    auto size() const -> std::size_t { return _size; }
+
+    // Drops the pages before `offset` from memory, they are not read again.
+    // This is what keeps the resident size constant on large files.
+    auto release(std::size_t offset) -> void {
+        const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const auto end = offset / page * page;
+
+        if (end > _released) {
+            ::madvise(const_cast<char*>(_data) + _released, end - _released,
+                      MADV_DONTNEED);
+            _released = end;
+        }
+    }
+
+   private:
+    MappedFile(const char* data, std::size_t size) : _data(data), _size(size) {}
+
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+    std::size_t _released = 0;
+};
+
+namespace detail {
+
+inline auto trim(std::string_view str) -> std::string_view {
+    while (not str.empty() and (str.front() == ' ' or str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (not str.empty() and (str.back() == ' ' or str.back() == '\t' or
+                                str.back() == '\r')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+}  // namespace detail
+
+// Comma separated values with a header line naming the columns. Rows are
+// decoded a chunk at a time into one buffer per column.
+template <class F>
+class CsvColumns {
+   public:
+    static auto open(const std::string& path) -> std::optional<CsvColumns> {
+        auto file = MappedFile::open(path);
+
+        if (not file) {
+            return std::nullopt;
+        }
+
+        CsvColumns csv(std::move(*file));
+
+        const auto header = csv.line();
+        ASSERT(header, "Missing header in " << path);
+
+        for (auto names = *header;;) {
+            const auto comma = names.find(',');
+            csv._names.emplace_back(detail::trim(names.substr(0, comma)));
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            names.remove_prefix(comma + 1);
+        }
+        csv._columns.resize(csv._names.size());
+
+        return csv;
+    }
+
+    auto names() const -> const std::vector<std::string>& { return _names; }
+
+    // Decodes up to `rows` rows, returns how many there were.
+    auto next(std::size_t rows) -> std::optional<std::size_t> {
+        for (auto&& column : _columns) {
+            column.clear();
+            column.reserve(rows);
+        }
+
+        std::size_t decoded = 0;
+
+        while (decoded < rows) {
+            const auto row = line();
+            if (not row) {
+                break;
+            }
+            if (detail::trim(*row).empty()) {
+                continue;
+            }
+
+            auto fields = *row;
+            for (std::size_t i = 0; i < _columns.size(); ++i) {
+                const auto comma = fields.find(',');
+                const auto field = detail::trim(fields.substr(0, comma));
+
+                F value{};
+                const auto [end, error] = std::from_chars(
+                    field.data(), field.data() + field.size(), value);
+
+                ASSERT(error == std::errc{} and
+                           end == field.data() + field.size(),
+                       "Malformed value `" << field << "` on line " << _line);
+                ASSERT((comma == std::string_view::npos) ==
+                           (i + 1 == _columns.size()),
+                       "Expected " << _columns.size() << " values on line "
+                                   << _line);
+
+                _columns[i].push_back(value);
+                fields.remove_prefix(
+                    comma == std::string_view::npos ? fields.size()
+                                                    : comma + 1);
+            }
+            ++decoded;
+        }
+
+        _file.release(_offset);
+
+        return decoded;
+    }
+
+    auto column(std::size_t i) const -> const F* { return _columns[i].data(); }
+
+   private:
+    explicit CsvColumns(MappedFile file) : _file(std::move(file)) {}
+
+    auto line() -> std::optional<std::string_view> {
+        if (_offset >= _file.size()) {
+            return std::nullopt;
+        }
+
+        const std::string_view rest(_file.data() + _offset,
+                                    _file.size() - _offset);
+        const auto end = std::min(rest.find('\n'), rest.size());
+
+        _offset += end + 1;
+        ++_line;
+
+        return rest.substr(0, end);
+    }
+
+    MappedFile _file;
+    std::size_t _offset = 0;
+    std::size_t _line = 0;
+    std::vector<std::string> _names;
+    std::vector<std::vector<F>> _columns;
+};
+
+// Files of raw native F values, one column each, bound to the variable named
+// after the file: `data/price.f64` holds `price`. Rows are read in place.
+template <class F>
+class BinaryColumns {
+   public:
+    static auto open(std::span<const std::string> paths)
+        -> std::optional<BinaryColumns> {
+        BinaryColumns columns;
+
+        for (auto&& path : paths) {
+            auto file = MappedFile::open(path);
+
+            if (not file) {
+                return std::nullopt;
+            }
+
+            ASSERT(file->size() % sizeof(F) == 0,
+                   path << " is not a column of " << sizeof(F)
+                        << " byte values");
+
+            const auto rows = file->size() / sizeof(F);
+            ASSERT(columns._files.empty() or rows == columns._rows,
+                   path << " has " << rows << " rows, expected "
+                        << columns._rows);
+
+            const auto slash = path.find_last_of('/');
+            const auto name = path.substr(
+                slash == std::string::npos ? 0 : slash + 1);
+
+            columns._names.push_back(name.substr(0, name.find('.')));
+            columns._files.push_back(std::move(*file));
+            columns._rows = rows;
+        }
+
+        return columns;
+    }
+
+    auto names() const -> const std::vector<std::string>& { return _names; }
+
+    // Advances to the next chunk of up to `rows` rows, returns its size.
+    auto next(std::size_t rows) -> std::optional<std::size_t> {
+        _row += _chunk;
+        _chunk = std::min(rows, _rows - _row);
+
+        for (auto&& file : _files) {
+            file.release(_row * sizeof(F));
+        }
+
+        return _chunk;
+    }
+
+    auto column(std::size_t i) const -> const F* {
+        return reinterpret_cast<const F*>(_files[i].data()) + _row;
+    }
+
+   private:
+    BinaryColumns() = default;
+
+    std::vector<MappedFile> _files;
+    std::vector<std::string> _names;
+    std::size_t _rows = 0;
+    std::size_t _row = 0;
+    std::size_t _chunk = 0;
+};
+
+// Evaluates the program for every row of `source`, binding each variable to
+// the column of the same name. Rows are decoded and evaluated `chunk` at a
+// time and every chunk of results is passed to `sink`, which returns false
+// to stop. Random builtins draw sample `first.index` + r of `first.seed` for
+// row r, so no two rows share their numbers. Returns the number of rows
+// evaluated.
+template <class F, class Source, class Sink>
+auto run_columns(const Program<F>& program, Source& source, Sink sink,
+                 std::size_t chunk = 64 * batch_block,
+                 MathMode mode = MathMode::Exact, Sample first = {})
+    -> std::optional<std::size_t> {
+    std::vector<std::optional<std::size_t>> index(program.names.size());
+    std::vector<std::string_view> undefined;
+    // variables assigned before they are read need no column
+    const auto needed = detail::inputs(program);
+
+    for (std::size_t slot = 0; slot < index.size(); ++slot) {
+        const auto& name = program.names[slot];
+        const auto found = std::ranges::find(source.names(), name);
+
+        if (found != source.names().end()) {
+            index[slot] =
+                static_cast<std::size_t>(found - source.names().begin());
+        } else if (needed[slot]) {
+            undefined.push_back(name);
+        }
+    }
+
+    ASSERT(undefined.empty(),
+           "Undefined variables " << detail::make_delimited_print(undefined));
+
+    std::vector<const F*> columns(program.names.size());
+    std::vector<F> results(chunk);
+    std::size_t total = 0;
+
+    for (;;) {
+        const auto rows = source.next(chunk);
+
+        if (not rows) {
+            return std::nullopt;
+        }
+        if (*rows == 0) {
+            return total;
+        }
+
+        for (std::size_t slot = 0; slot < columns.size(); ++slot) {
+            columns[slot] = index[slot] ? source.column(*index[slot]) : nullptr;
+        }
+
+        if (not run_batch(program, std::span<const F* const>(columns),
+                          results.data(), *rows, mode,
+                          Sample{first.seed, first.index + total}) or
+            not sink(std::span<const F>(results.data(), *rows))) {
+            return std::nullopt;
+        }
+
+        total += *rows;
+    }
+}
+
+}  // namespace calc
+
+#endif
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "prelude.hpp"
+#include "variables.hpp"
+
+namespace calc {
+
+namespace detail {
+
+template <class C>
+struct string_hash {
+    using is_transparent = void;
+
+    auto operator()(std::basic_string_view<C> str) const -> std::size_t {
+        return std::hash<std::basic_string_view<C>>{}(str);
+    }
+};
+
+}  // namespace detail
+
+// Variables shared between evaluating threads and the threads feeding them.
+//
+// Bindings live in immutable snapshots. A reader announces the epoch it
+// entered in a slot of its own and loads the current snapshot, so `get` never
+// takes a lock and never touches a cache line written by another reader.
+// Writers queue bindings with `set`, and `publish` swaps in a new snapshot
+// containing the whole batch. A replaced snapshot is freed once every active
+// reader has announced a later epoch.
+//
+// Up to `readers` threads hold a slot at once. Readers beyond that never
+// wait, they are counted together and nothing is freed while any of them is
+// active, so memory grows with the publishes made meanwhile.
+template <class F, class It, std::size_t readers = 64>
+class ConcurrentVariables {
+    using value_type = std::iter_value_t<It>;
+    using str = std::basic_string<value_type>;
+    using str_view = std::basic_string_view<value_type>;
+    using registry = std::unordered_map<str, F, detail::string_hash<value_type>,
+                                        std::equal_to<>>;
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<std::uint64_t> epoch = 0;
+    };
+
+    class Pin {
+       public:
+        explicit Pin(const ConcurrentVariables& owner) {
+            const auto hint =
+                std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+            for (std::size_t i = 0; i < readers and not _slot; ++i) {
+                auto& slot = owner._slots[(hint + i) % readers];
+                auto idle = std::uint64_t{0};
+
+                if (slot.epoch.compare_exchange_strong(idle,
+                                                       owner._epoch.load())) {
+                    _slot = &slot;
+                }
+            }
+
+            // every slot is taken, hold back reclamation altogether instead
+            // of waiting for one
+            if (not _slot) {
+                _overflow = &owner._overflow;
+                _overflow->fetch_add(1);
+            }
+
+            _registry = owner._current.load();
+        }
+
+        Pin(Pin&& other) noexcept
+            : _slot(std::exchange(other._slot, nullptr)),
+              _overflow(std::exchange(other._overflow, nullptr)),
+              _registry(other._registry) {}
+
+        Pin(const Pin&) = delete;
+        auto operator=(const Pin&) -> Pin& = delete;
+        auto operator=(Pin&&) -> Pin& = delete;
+
+        ~Pin() {
+            if (_slot) {
+                _slot->epoch.store(0);
+            }
+            if (_overflow) {
+                _overflow->fetch_sub(1);
+            }
+        }
+
+        auto registry() const -> const ConcurrentVariables::registry& {
+            return *_registry;
+        }
+
+       private:
+        ReaderSlot* _slot = nullptr;
+        std::atomic<std::size_t>* _overflow = nullptr;
+        const ConcurrentVariables::registry* _registry = nullptr;
+    };
+
+   public:
+    // Consistent view of the bindings for one evaluation. Assignments made
+    // by the evaluation are visible to it immediately and are queued on the
+    // owning store for the next `publish`.
+    class Snapshot {
+       public:
+        explicit Snapshot(ConcurrentVariables& owner)
+            : _owner(&owner), _pin(owner) {}
+
+        auto get(str_view name) const -> std::optional<F> {
+            if (const auto constant = detail::constant<F>(name)) {
+                return constant;
+            }
+            if (const auto local = _local.find(name); local != _local.end()) {
+                return local->second;
+            }
+            if (const auto shared = _pin.registry().find(name);
+                shared != _pin.registry().end()) {
+                return shared->second;
+            }
+            return std::nullopt;
+        }
+
+        auto set(str_view name, F value) -> Snapshot& {
+            _local.insert_or_assign(str(name), value);
+            _owner->set(name, value);
+            return *this;
+        }
+
+       private:
+        ConcurrentVariables* _owner;
+        Pin _pin;
+        ConcurrentVariables::registry _local;
+    };
+
+    ConcurrentVariables() : _current(new registry) {}
+
+    ConcurrentVariables(const ConcurrentVariables&) = delete;
+    auto operator=(const ConcurrentVariables&)
+        -> ConcurrentVariables& = delete;
+
+    ~ConcurrentVariables() {
+        delete _current.load();
+        for (auto&& [epoch, retired] : _retired) {
+            delete retired;
+        }
+    }
+
+    auto snapshot() -> Snapshot { return Snapshot(*this); }
+
+    auto get(str_view name) const -> std::optional<F> {
+        if (const auto constant = detail::constant<F>(name)) {
+            return constant;
+        }
+        const Pin pin(*this);
+        if (const auto result = pin.registry().find(name);
+            result != pin.registry().end()) {
+            return result->second;
+        }
+        return std::nullopt;
+    }
+
+    // Queues a binding, readers see it after the next `publish`.
+    auto set(str_view name, F value) -> ConcurrentVariables& {
+        const std::scoped_lock lock(_writer);
+        _pending.insert_or_assign(str(name), value);
+        return *this;
+    }
+
+    // Makes all queued bindings visible at once, returns how many there were.
+    auto publish() -> std::size_t {
+        const std::scoped_lock lock(_writer);
+
+        if (_pending.empty()) {
+            return 0;
+        }
+
+        const auto* previous = _current.load();
+        auto* next = new registry(*previous);
+
+        for (auto&& [name, value] : _pending) {
+            next->insert_or_assign(name, value);
+        }
+
+        const auto published = _pending.size();
+        _pending.clear();
+
+        _current.store(next);
+        _retired.emplace_back(_epoch.fetch_add(1), previous);
+
+        reclaim();
+
+        return published;
+    }
+
+    friend auto& operator<<(std::basic_ostream<value_type>& os,
+                            const ConcurrentVariables& vars) {
+        const Pin pin(vars);
+        calc::print(
+            [&os](auto&& e) { os << e.first << " = " << e.second << '\n'; },
+            pin.registry());
+        return os;
+    }
+
+   private:
+    // Frees snapshots retired before the oldest epoch a reader still holds.
+    auto reclaim() -> void {
+        if (_overflow.load() != 0) {
+            return;
+        }
+
+        auto oldest = UINT64_MAX;
+        for (auto&& slot : _slots) {
+            const auto epoch = slot.epoch.load();
+            if (epoch != 0 and epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+
+        std::erase_if(_retired, [oldest](auto&& retired) {
+            if (retired.first >= oldest) {
+                return false;
+            }
+            delete retired.second;
+            return true;
+        });
+    }
+
+    mutable std::array<ReaderSlot, readers> _slots;
+    mutable std::atomic<std::size_t> _overflow = 0;
+    std::atomic<std::uint64_t> _epoch = 1;
+    std::atomic<const registry*> _current;
+
+    std::mutex _writer;
+    registry _pending;
+    std::vector<std::pair<std::uint64_t, const registry*>> _retired;
+};
+
+}  // namespace calc
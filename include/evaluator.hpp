@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <charconv>
 #include <cmath>
 #include <iterator>
@@ -11,6 +12,7 @@
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "prelude.hpp"
+#include "random.hpp"
 
 namespace calc {
 
@@ -83,7 +85,7 @@ auto eval_fn(auto fn, auto name, std::vector<F>& stack) -> std::optional<F> {
 }
 
 template <class It, class F, class Fn>
-auto try_eval_unary_fn(typename Token<It>::Type, str_view<It> name,
+auto try_eval_unary_fn(TokenType, str_view<It> name,
                        std::vector<F>& stack, Fn not_found)
     -> std::optional<F> {
     if (name == "sqrt") {
@@ -148,7 +150,7 @@ auto try_eval_unary_fn(typename Token<It>::Type, str_view<It> name,
 }
 
 template <class It, class F, class Fn>
-auto try_eval_binary_fn(typename Token<It>::Type type, str_view<It> name,
+auto try_eval_binary_fn(TokenType type, str_view<It> name,
                         std::vector<F>& stack, Fn not_found)
     -> std::optional<F> {
     switch (type) {
@@ -189,9 +191,11 @@ auto try_eval_binary_fn(typename Token<It>::Type type, str_view<It> name,
     }
 
     if (name == "min") {
-        return eval_fn<2>(std::min<F>, name, stack);
+        return eval_fn<2>([](F a, F b) { return std::min(a, b); }, name,
+                          stack);
     } else if (name == "max") {
-        return eval_fn<2>(std::max<F>, name, stack);
+        return eval_fn<2>([](F a, F b) { return std::max(a, b); }, name,
+                          stack);
     } else if (name == "log") {
         return eval_fn<2>(
             [](auto a, auto b) { return std::log(a) / std::log(b); }, name,
@@ -244,10 +248,46 @@ auto try_eval_binary_fn(typename Token<It>::Type type, str_view<It> name,
 }
 
 template <class It, class F, class Fn>
-auto try_eval_fn(typename Token<It>::Type type, str_view<It> name,
+auto try_eval_ternary_fn(TokenType, str_view<It> name,
+                         std::vector<F>& stack, Fn not_found)
+    -> std::optional<F> {
+    if (name == "if") {
+        return eval_fn<3>(
+            [](F condition, F then, F otherwise) {
+                return static_cast<int>(condition) ? then : otherwise;
+            },
+            name, stack);
+    }
+
+    return not_found();
+}
+
+// Every call draws from the next sample of the calling thread.
+template <class It, class F, class Fn>
+auto try_eval_random_fn(TokenType, str_view<It> name,
+                        std::vector<F>& stack, Fn not_found)
+    -> std::optional<F> {
+    if (name == "rand") {
+        return eval_fn<0>([]() { return uniform<F>(next_sample(), 0); }, name,
+                          stack);
+    } else if (name == "normal") {
+        return eval_fn<2>(
+            [](F mu, F sigma) { return normal(next_sample(), 0, mu, sigma); },
+            name, stack);
+    }
+
+    return not_found();
+}
+
+template <class It, class F, class Fn>
+auto try_eval_fn(TokenType type, str_view<It> name,
                  std::vector<F>& stack, Fn not_found) -> std::optional<F> {
     return try_eval_unary_fn<It>(type, name, stack, [&]() {
-        return try_eval_binary_fn<It>(type, name, stack, not_found);
+        return try_eval_binary_fn<It>(type, name, stack, [&]() {
+            return try_eval_ternary_fn<It>(type, name, stack, [&]() {
+                return try_eval_random_fn<It>(type, name, stack, not_found);
+            });
+        });
     });
 }
 
@@ -289,31 +329,26 @@ constexpr auto perform(const Token<It>& identifier, std::vector<F>& stack,
     const auto eval_result =
         try_eval_fn<It>(identifier.type, identifier_name, stack, not_found);
 
-    return eval_result ? true : std::nullopt;
+    return eval_result ? std::make_optional(true) : std::nullopt;
 }
 
 }  // namespace detail
 
+// Runs a queue produced by `parse`.
 template <class F, class It>
-constexpr auto evaluate(It begin, It end,
-                        variables_handle<F, It> auto& variables)
+constexpr auto execute(const std::vector<Token<It>>& queue,
+                       variables_handle<F, It> auto& variables)
     -> std::optional<F> {
     using namespace detail;
 
-    const auto queue = parse(begin, end);
-
-    if (not queue) {
-        return std::nullopt;
-    }
-
-    // calc::print([](auto&& v) { std::cout << v << " "; }, *queue);
+    // calc::print([](auto&& v) { std::cout << v << " "; }, queue);
 
     std::vector<F> stack;
     detail::variables_stack<It> runtime_variables;
 
-    for (auto&& token : *queue) {
+    for (auto&& token : queue) {
         if (not perform<F, It>(token, stack, runtime_variables, variables)) {
-            break;
+            return std::nullopt;
         }
     }
 
@@ -325,4 +360,17 @@ constexpr auto evaluate(It begin, It end,
     return stack.back();
 }
 
+template <class F, class It>
+constexpr auto evaluate(It begin, It end,
+                        variables_handle<F, It> auto& variables)
+    -> std::optional<F> {
+    const auto queue = parse(begin, end);
+
+    if (not queue) {
+        return std::nullopt;
+    }
+
+    return execute<F, It>(*queue, variables);
+}
+
 }  // namespace calc
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+// How many times each rewrite of `fast_math` fired.
+struct FastMathReport {
+    std::size_t power_chains = 0;
+    std::size_t square_roots = 0;
+    std::size_t reciprocals = 0;
+    std::size_t exp_products = 0;
+    std::size_t ln_sums = 0;
+    std::size_t fused_multiply_adds = 0;
+};
+
+inline auto& operator<<(std::ostream& os, const FastMathReport& report) {
+    return os << "power_chains=" << report.power_chains
+              << " square_roots=" << report.square_roots
+              << " reciprocals=" << report.reciprocals
+              << " exp_products=" << report.exp_products
+              << " ln_sums=" << report.ln_sums
+              << " fused_multiply_adds=" << report.fused_multiply_adds;
+}
+
+namespace detail {
+
+// Largest integer exponent expanded into multiplications.
+constexpr int max_power_chain = 64;
+
+// Whether `std::fma` is a single instruction for F on the target.
+template <class F>
+constexpr bool fast_fma =
+#ifdef FP_FAST_FMA
+    std::is_same_v<F, double> or
+#endif
+#ifdef FP_FAST_FMAF
+    std::is_same_v<F, float> or
+#endif
+#ifdef FP_FAST_FMAL
+    std::is_same_v<F, long double> or
+#endif
+    false;
+
+// Rebuilds an eager program with the rewrites of `fast_math` applied. A
+// pattern spanning several instructions is only rewritten when the inner
+// ones have no other use, so no work is duplicated.
+template <class F>
+class FastMath {
+   public:
+    FastMath(const Program<F>& eager, FastMathReport& report)
+        : _eager(eager), _report(report) {}
+
+    auto operator()() -> Program<F> {
+        std::vector<std::uint32_t> uses(_eager.code.size());
+        for (auto&& instruction : _eager.code) {
+            for_each_operand(instruction, [&uses](std::uint32_t operand) {
+                ++uses[operand];
+            });
+        }
+
+        _program.names = _eager.names;
+        std::vector<std::uint32_t> index(_eager.code.size());
+
+        for (std::size_t i = 0; i < _eager.code.size(); ++i) {
+            auto instruction = _eager.code[i];
+            for_each_operand(instruction, [&](std::uint32_t& operand) {
+                operand = index[operand];
+            });
+            index[i] = rewrite(instruction);
+            _uses[index[i]] += uses[i];
+        }
+
+        _program.result = index[_eager.result];
+        return std::move(_program);
+    }
+
+   private:
+    auto rewrite(const Instruction<F>& instruction) -> std::uint32_t {
+        const auto [op, a, b, c, value] = instruction;
+
+        switch (op) {
+            case Op::Pow: {
+                const auto exponent = constant(b);
+                if (not exponent) {
+                    break;
+                }
+                if (*exponent == 0.5) {
+                    ++_report.square_roots;
+                    return emit({Op::Sqrt, a});
+                }
+                if (std::trunc(*exponent) == *exponent and
+                    std::abs(*exponent) <= max_power_chain) {
+                    ++_report.power_chains;
+                    const auto n = static_cast<int>(*exponent);
+                    if (n == 0) {
+                        return emit({Op::Const, 0, 0, 0, 1});
+                    }
+                    const auto chain = power(a, std::abs(n));
+                    return n > 0 ? chain
+                                 : emit({Op::Div,
+                                         emit({Op::Const, 0, 0, 0, 1}),
+                                         chain});
+                }
+                break;
+            }
+            case Op::Div:
+                // a subnormal reciprocal has lost bits already
+                if (const auto divisor = constant(b);
+                    divisor and std::isnormal(1 / *divisor)) {
+                    ++_report.reciprocals;
+                    const auto reciprocal =
+                        emit({Op::Const, 0, 0, 0, 1 / *divisor});
+                    return emit({Op::Mul, a, reciprocal});
+                }
+                break;
+            case Op::Mul:
+                if (single(a, Op::Exp) and single(b, Op::Exp)) {
+                    ++_report.exp_products;
+                    return emit({Op::Exp, emit({Op::Add, _program.code[a].a,
+                                                _program.code[b].a})});
+                }
+                break;
+            case Op::Add:
+                if (single(a, Op::Ln) and single(b, Op::Ln)) {
+                    ++_report.ln_sums;
+                    return emit({Op::Ln, emit({Op::Mul, _program.code[a].a,
+                                               _program.code[b].a})});
+                }
+                if constexpr (fast_fma<F>) {
+                    for (const auto [product, addend] : {std::pair(a, b),
+                                                         std::pair(b, a)}) {
+                        if (single(product, Op::Mul)) {
+                            ++_report.fused_multiply_adds;
+                            const auto& mul = _program.code[product];
+                            return emit({Op::Fma, mul.a, mul.b, addend});
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        return emit(instruction);
+    }
+
+    // `base ** n` by repeated squaring, n > 0.
+    auto power(std::uint32_t base, int n) -> std::uint32_t {
+        std::optional<std::uint32_t> result;
+        for (; n > 0; n >>= 1) {
+            if (n & 1) {
+                result = result ? emit({Op::Mul, *result, base}) : base;
+            }
+            if (n > 1) {
+                base = emit({Op::Mul, base, base});
+            }
+        }
+        return *result;
+    }
+
+    auto constant(std::uint32_t i) const -> std::optional<F> {
+        const auto& instruction = _program.code[i];
+        if (instruction.op != Op::Const) {
+            return std::nullopt;
+        }
+        return instruction.value;
+    }
+
+    auto single(std::uint32_t i, Op op) const -> bool {
+        return _program.code[i].op == op and _uses[i] == 1;
+    }
+
+    auto emit(Instruction<F> instruction) -> std::uint32_t {
+        _uses.push_back(0);
+        return detail::emit(_program, instruction);
+    }
+
+    const Program<F>& _eager;
+    FastMathReport& _report;
+    Program<F> _program;
+    std::vector<std::uint32_t> _uses;
+};
+
+}  // namespace detail
+
+// Rewrites the program into a faster one that rounds differently:
+//
+// | rewrite                   | deviation from the strict program          |
+// | ------------------------- | ------------------------------------------ |
+// | `x ** n`, integer n <= 64 | multiply chain, up to |n| ulp              |
+// | `x ** 0.5` to `sqrt(x)`   | 1 ulp, sqrt rounds correctly, pow does not |
+// |                           | always; differs for -0 and -inf            |
+// | `x / c` to `x * (1 / c)`  | 1 ulp, none when c is a power of two; not  |
+// |                           | done when 1 / c is subnormal or infinite   |
+// | `exp(a) * exp(b)`         | `exp(a + b)`, |a + b| + 2 ulp, overflows at |
+// |                           | a different a + b                          |
+// | `ln(a) + ln(b)`           | `ln(a * b)`, 2 ulp of ln(a) or ln(b), inf  |
+// |                           | or -inf where a * b overflows or           |
+// |                           | underflows, defined for negative a and b   |
+// | `a * b + c` to `fma`      | rounded once, only with FP_FAST_FMA        |
+//
+// tests/fast_math.cpp checks these bounds over random arguments.
+//
+// `report` receives how many times each rewrite fired.
+template <class F>
+auto fast_math(const Program<F>& program, FastMathReport& report)
+    -> Program<F> {
+    // constant subexpressions are folded first so `x ** (1 / 2)` is found
+    const auto eager =
+        detail::fold(detail::strip(program),
+                     [](std::string_view) -> std::optional<F> { return {}; });
+    const auto rewritten = detail::FastMath(eager, report)();
+
+    return detail::Lowering(rewritten)();
+}
+
+template <class F>
+auto fast_math(const Program<F>& program) -> Program<F> {
+    FastMathReport report;
+    return fast_math(program, report);
+}
+
+}  // namespace calc
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "batch.hpp"
+#include "interval.hpp"
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+// Rows `filter` decided from the bounds of their block, and rows it had to
+// evaluate one by one.
+struct FilterReport {
+    std::size_t rejected = 0;
+    std::size_t accepted = 0;
+    std::size_t evaluated = 0;
+};
+
+inline auto& operator<<(std::ostream& os, const FilterReport& report) {
+    return os << "rejected=" << report.rejected
+              << " accepted=" << report.accepted
+              << " evaluated=" << report.evaluated;
+}
+
+namespace detail {
+
+// Smallest interval holding `n` values.
+template <class F>
+auto range(const F* values, std::size_t n) -> Interval<F> {
+    auto lo = infinity<F>, hi = -infinity<F>;
+    bool nan = false;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        // NaN compares false, so it leaves both bounds alone
+        lo = values[i] < lo ? values[i] : lo;
+        hi = values[i] > hi ? values[i] : hi;
+        nan = nan or values[i] != values[i];
+    }
+
+    return {lo, hi, nan};
+}
+
+}  // namespace detail
+
+// Appends to `selected` the index of every row for which the predicate
+// program is true, with the variables bound to `columns` like `run_batch`
+// does. The predicate is first bounded over the range of every column in a
+// block of rows: blocks where it is true or false throughout are decided
+// from that alone, the others are evaluated row by row. Random builtins draw
+// sample r of seed 0 for row r.
+template <class F>
+auto filter(const Program<F>& program, std::span<const F* const> columns,
+            std::size_t rows, std::vector<std::size_t>& selected)
+    -> std::optional<FilterReport> {
+    ASSERT(columns.size() >= program.names.size(),
+           "Expected a column for each of " << program.names.size()
+                                            << " variables");
+
+    FilterReport report;
+    std::vector<Interval<F>> ranges(program.names.size());
+    std::vector<Interval<F>> values;
+    std::vector<const F*> offset(program.names.size());
+    std::vector<F> results(batch_block);
+
+    for (std::size_t row = 0; row < rows; row += batch_block) {
+        const auto n = std::min(batch_block, rows - row);
+
+        for (std::size_t slot = 0; slot < ranges.size(); ++slot) {
+            if (columns[slot]) {
+                ranges[slot] = detail::range(columns[slot] + row, n);
+            }
+        }
+
+        const auto truth = detail::truthiness(bound(
+            program, std::span<const Interval<F>>(ranges), values));
+
+        if (truth.lo == truth.hi) {
+            if (truth.lo == 1) {
+                for (std::size_t i = row; i < row + n; ++i) {
+                    selected.push_back(i);
+                }
+                report.accepted += n;
+            } else {
+                report.rejected += n;
+            }
+            continue;
+        }
+
+        // an undecided block is evaluated at once, so at most one block of
+        // results is held
+        for (std::size_t slot = 0; slot < offset.size(); ++slot) {
+            offset[slot] = columns[slot] ? columns[slot] + row : nullptr;
+        }
+        if (not run_batch(program, std::span<const F* const>(offset),
+                          results.data(), n, MathMode::Exact,
+                          Sample{0, row})) {
+            return std::nullopt;
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            if (detail::truthy(results[i])) {
+                selected.push_back(row + i);
+            }
+        }
+        report.evaluated += n;
+    }
+
+    return report;
+}
+
+}  // namespace calc
@@ -0,0 +1,546 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+// Every value between `lo` and `hi`, and NaN as well when `nan` is set. An
+// interval with lo > hi holds no number.
+template <class F>
+struct Interval {
+    F lo = 0;
+    F hi = 0;
+    bool nan = false;
+};
+
+namespace detail {
+
+template <class F>
+constexpr auto infinity = std::numeric_limits<F>::infinity();
+
+// Bounds computed by a function of the C library are widened by this many
+// representable numbers on each side to cover its rounding errors.
+constexpr int libm_ulps = 4;
+
+// Largest value of a normal number drawn by `normal(0, 1)`, reached when
+// the uniform number it starts from is the smallest one above zero.
+constexpr double normal_radius = 8.6;
+
+template <class F>
+constexpr auto entire(bool nan) -> Interval<F> {
+    return {-infinity<F>, infinity<F>, nan};
+}
+
+template <class F>
+constexpr auto nothing() -> Interval<F> {
+    return {infinity<F>, -infinity<F>, true};
+}
+
+template <class F>
+constexpr auto empty(Interval<F> x) -> bool {
+    return x.lo > x.hi;
+}
+
+template <class F>
+constexpr auto hull(Interval<F> a, Interval<F> b) -> Interval<F> {
+    return {std::min(a.lo, b.lo), std::max(a.hi, b.hi), a.nan or b.nan};
+}
+
+// Rounds the bounds outwards by `ulps` representable numbers.
+template <class F>
+auto widen(Interval<F> x, int ulps) -> Interval<F> {
+    for (; ulps > 0 and not empty(x); --ulps) {
+        x.lo = std::nextafter(x.lo, -infinity<F>);
+        x.hi = std::nextafter(x.hi, infinity<F>);
+    }
+    return x;
+}
+
+// Whether the interval holds one number only, taking -0 and +0 as one.
+template <class F>
+constexpr auto single(Interval<F> x) -> bool {
+    return x.lo == x.hi and not x.nan;
+}
+
+// [1, 1] when every value is true, [0, 0] when every value is false and
+// [0, 1] otherwise.
+template <class F>
+constexpr auto decided(bool always, bool never) -> Interval<F> {
+    return {always ? F{1} : F{0}, never ? F{0} : F{1}};
+}
+
+// Truth values of `truthy` over the interval. NaN converts to whatever the
+// target makes of it, so it leaves the truth undecided.
+template <class F>
+constexpr auto truthiness(Interval<F> x) -> Interval<F> {
+    return decided<F>(not x.nan and (x.lo >= 1 or x.hi <= -1),
+                      not x.nan and x.lo > -1 and x.hi < 1);
+}
+
+// Bounds of `fn` monotonic on its domain [from, to], which gives NaN for
+// values outside of it.
+template <class F, class Fn>
+auto monotonic(Interval<F> x, Fn fn, F from, F to, bool increasing, int ulps)
+    -> Interval<F> {
+    const auto nan = x.nan or x.lo < from or x.hi > to;
+    const auto lo = std::max(x.lo, from), hi = std::min(x.hi, to);
+
+    if (lo > hi) {
+        return nothing<F>();
+    }
+
+    const auto a = fn(lo), b = fn(hi);
+    return widen(increasing ? Interval<F>{a, b, nan} : Interval<F>{b, a, nan},
+                 ulps);
+}
+
+// Bounds of `fn` monotonic in each argument, which take their extremes at
+// the ends. A NaN end comes from infinities cancelling, nothing is known
+// then.
+template <class F, class Fn>
+auto corners(Interval<F> a, Interval<F> b, Fn fn, int ulps) -> Interval<F> {
+    if (empty(a) or empty(b)) {
+        return nothing<F>();
+    }
+
+    const std::array<F, 4> ends = {fn(a.lo, b.lo), fn(a.lo, b.hi),
+                                   fn(a.hi, b.lo), fn(a.hi, b.hi)};
+
+    if (std::ranges::any_of(ends, [](F end) { return std::isnan(end); })) {
+        return entire<F>(true);
+    }
+
+    const auto [lo, hi] = std::ranges::minmax(ends);
+    return widen(Interval<F>{lo, hi, a.nan or b.nan}, ulps);
+}
+
+template <class F>
+auto absolute(Interval<F> x) -> Interval<F> {
+    if (empty(x) or x.lo >= 0) {
+        return x;
+    }
+    if (x.hi <= 0) {
+        return {-x.hi, -x.lo, x.nan};
+    }
+    return {0, std::max(-x.lo, x.hi), x.nan};
+}
+
+// Bounds of sin, or of cos when `cosine` is set. Far from zero the argument
+// reduction is too coarse to tell where the peaks are.
+template <class F>
+auto sine(Interval<F> x, bool cosine) -> Interval<F> {
+    constexpr F reduced = 1 << 20;
+
+    if (empty(x)) {
+        return x;
+    }
+    if (std::isinf(x.lo) or std::isinf(x.hi)) {
+        return {-1, 1, true};
+    }
+    if (x.hi - x.lo >= TAU or x.lo < -reduced or x.hi > reduced) {
+        return {-1, 1, x.nan};
+    }
+
+    const auto fn = [cosine](F value) {
+        return cosine ? std::cos(value) : std::sin(value);
+    };
+    const auto [a, b] = std::minmax(fn(x.lo), fn(x.hi));
+    Interval<F> y{a, b, x.nan};
+
+    // whether x holds a point of `at` plus a multiple of tau
+    const auto holds = [&x](F at) {
+        return std::ceil((x.lo - at) / TAU) * TAU + at <= x.hi;
+    };
+    const F peak = cosine ? 0 : HALF_PI;
+
+    if (holds(peak)) {
+        y.hi = 1;
+    }
+    if (holds(peak - PI)) {
+        y.lo = -1;
+    }
+
+    return widen(y, libm_ulps);
+}
+
+// tan is increasing between its poles, so it increases over x unless a pole
+// lies inside.
+template <class F>
+auto tangent(Interval<F> x) -> Interval<F> {
+    if (empty(x)) {
+        return x;
+    }
+    if (std::isinf(x.lo) or std::isinf(x.hi)) {
+        return entire<F>(true);
+    }
+
+    const auto a = std::tan(x.lo), b = std::tan(x.hi);
+    if (x.hi - x.lo >= PI or a > b) {
+        return entire<F>(x.nan);
+    }
+    return widen(Interval<F>{a, b, x.nan}, libm_ulps);
+}
+
+template <class F>
+auto divide(Interval<F> a, Interval<F> b) -> Interval<F> {
+    if (not empty(b) and b.lo <= 0 and b.hi >= 0) {
+        return entire<F>(a.nan or b.nan or (a.lo <= 0 and a.hi >= 0));
+    }
+    return corners(a, b, [](F x, F y) { return x / y; }, 1);
+}
+
+// Bounds of pow over the numbers of `a` and `b`, NaN in either operand gives
+// NaN.
+template <class F>
+auto power_of_numbers(Interval<F> a, Interval<F> b) -> Interval<F> {
+    const auto pow = [](F x, F y) { return std::pow(x, y); };
+
+    if (empty(a) or empty(b)) {
+        return nothing<F>();
+    }
+    if (a.lo >= 0) {
+        // -0 to a negative odd power is -inf, +0 gives +inf
+        auto y = corners(Interval<F>{std::abs(a.lo), a.hi, a.nan}, b, pow,
+                         libm_ulps);
+        if (a.lo == 0 and b.lo < 0) {
+            y.lo = -infinity<F>;
+        }
+        return y;
+    }
+    if (b.lo != b.hi or std::trunc(b.lo) != b.lo) {
+        // a negative base to a fractional power is NaN
+        return entire<F>(true);
+    }
+
+    const auto n = b.lo;
+
+    if (n == 0) {
+        return {1, 1, b.nan};
+    }
+    if (std::fmod(n, F{2}) == 0) {
+        return corners(absolute(a), b, pow, libm_ulps);
+    }
+    if (n < 0 and a.lo <= 0 and a.hi >= 0) {
+        return entire<F>(a.nan or b.nan);
+    }
+    // odd powers are increasing, their reciprocals decreasing on each side
+    return monotonic(
+        Interval<F>{a.lo, a.hi, a.nan or b.nan},
+        [n](F x) { return std::pow(x, n); }, -infinity<F>, infinity<F>, n > 0,
+        libm_ulps);
+}
+
+template <class F>
+auto power(Interval<F> a, Interval<F> b) -> Interval<F> {
+    // pow(NaN, 0) and pow(1, NaN) are 1
+    const auto one = (a.nan and not empty(b) and b.lo <= 0 and b.hi >= 0) or
+                     (b.nan and not empty(a) and a.lo <= 1 and a.hi >= 1);
+    const auto y = power_of_numbers(a, b);
+
+    return one ? hull(y, Interval<F>{1, 1}) : y;
+}
+
+template <class F>
+auto minimum(Interval<F> a, Interval<F> b, bool max) -> Interval<F> {
+    // like std::min and std::max, a NaN second operand gives the first one
+    if (empty(a) or empty(b)) {
+        return empty(a) ? nothing<F>() : a;
+    }
+
+    Interval<F> y = max ? Interval<F>{std::max(a.lo, b.lo),
+                                      std::max(a.hi, b.hi), a.nan or b.nan}
+                        : Interval<F>{std::min(a.lo, b.lo),
+                                      std::min(a.hi, b.hi), a.nan or b.nan};
+    return b.nan ? hull(y, a) : y;
+}
+
+template <class F>
+auto less(Interval<F> a, Interval<F> b, bool or_equal) -> Interval<F> {
+    const auto nan = a.nan or b.nan;
+
+    if (or_equal) {
+        return decided<F>(not nan and a.hi <= b.lo, a.lo > b.hi);
+    }
+    return decided<F>(not nan and a.hi < b.lo, a.lo >= b.hi);
+}
+
+template <class F>
+auto apply_interval(Op op, Interval<F> x) -> Interval<F> {
+    const auto inf = infinity<F>;
+
+    switch (op) {
+        case Op::Sqrt:
+            return monotonic(x, [](F v) { return std::sqrt(v); }, F{0}, inf,
+                             true, 1);
+        case Op::Cbrt:
+            return monotonic(x, [](F v) { return std::cbrt(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Abs:
+            return absolute(x);
+        case Op::Ln:
+            return monotonic(x, [](F v) { return std::log(v); }, F{0}, inf,
+                             true, libm_ulps);
+        case Op::Lg:
+            return monotonic(x, [](F v) { return std::log10(v); }, F{0}, inf,
+                             true, libm_ulps);
+        case Op::Exp:
+            return monotonic(x, [](F v) { return std::exp(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Ceil:
+            return monotonic(x, [](F v) { return std::ceil(v); }, -inf, inf,
+                             true, 0);
+        case Op::Floor:
+            return monotonic(x, [](F v) { return std::floor(v); }, -inf, inf,
+                             true, 0);
+        case Op::Round:
+            return monotonic(x, [](F v) { return std::round(v); }, -inf, inf,
+                             true, 0);
+        case Op::Trunc:
+            return monotonic(x, [](F v) { return std::trunc(v); }, -inf, inf,
+                             true, 0);
+        case Op::Sin:
+            return sine(x, false);
+        case Op::Asin:
+            return monotonic(x, [](F v) { return std::asin(v); }, F{-1}, F{1},
+                             true, libm_ulps);
+        case Op::Sinh:
+            return monotonic(x, [](F v) { return std::sinh(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Asinh:
+            return monotonic(x, [](F v) { return std::asinh(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Cos:
+            return sine(x, true);
+        case Op::Acos:
+            return monotonic(x, [](F v) { return std::acos(v); }, F{-1}, F{1},
+                             false, libm_ulps);
+        case Op::Cosh:
+            return monotonic(absolute(x), [](F v) { return std::cosh(v); },
+                             F{0}, inf, true, libm_ulps);
+        case Op::Acosh:
+            return monotonic(x, [](F v) { return std::acosh(v); }, F{1}, inf,
+                             true, libm_ulps);
+        case Op::Tan:
+            return tangent(x);
+        case Op::Atan:
+            return monotonic(x, [](F v) { return std::atan(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Tanh:
+            return monotonic(x, [](F v) { return std::tanh(v); }, -inf, inf,
+                             true, libm_ulps);
+        case Op::Atanh:
+            return monotonic(x, [](F v) { return std::atanh(v); }, F{-1}, F{1},
+                             true, libm_ulps);
+        default:
+            return x;
+    }
+}
+
+// Bounds a builtin of operands holding one number each by computing it,
+// for both signs of a zero operand, as intervals do not keep the sign.
+template <class F>
+auto apply_single(Op op, Interval<F> a, Interval<F> b) -> Interval<F> {
+    const auto signs = [](F x) {
+        return x == 0 ? std::array<F, 2>{0, -F{0}} : std::array<F, 2>{x, x};
+    };
+    Interval<F> y = nothing<F>();
+    y.nan = false;
+
+    for (const auto u : signs(a.lo)) {
+        for (const auto v : signs(b.lo)) {
+            const auto value = is_unary(op) ? apply(op, u) : apply(op, u, v);
+            y = std::isnan(value) ? Interval<F>{y.lo, y.hi, true}
+                                  : hull(y, Interval<F>{value, value});
+        }
+    }
+    return y;
+}
+
+template <class F>
+auto apply_interval(Op op, Interval<F> a, Interval<F> b) -> Interval<F> {
+    switch (op) {
+        case Op::Add:
+            return corners(a, b, [](F x, F y) { return x + y; }, 1);
+        case Op::Sub:
+            return corners(a, b, [](F x, F y) { return x - y; }, 1);
+        case Op::Mul:
+            return corners(a, b, [](F x, F y) { return x * y; }, 1);
+        case Op::Div:
+            return divide(a, b);
+        case Op::Mod: {
+            // fmod is exact, has the sign of `a` and is smaller than `b`
+            if (empty(a) or empty(b)) {
+                return nothing<F>();
+            }
+            const auto m = std::max(std::abs(b.lo), std::abs(b.hi));
+            const auto nan = a.nan or b.nan or (b.lo <= 0 and b.hi >= 0) or
+                             std::isinf(a.lo) or std::isinf(a.hi);
+            return {a.lo >= 0 ? F{0} : std::max(a.lo, -m),
+                    a.hi <= 0 ? F{0} : std::min(a.hi, m), nan};
+        }
+        case Op::Pow:
+            return power(a, b);
+        case Op::LessThan:
+            return less(a, b, false);
+        case Op::LessEquals:
+            return less(a, b, true);
+        case Op::GreaterThan:
+            return less(b, a, false);
+        case Op::GreaterEquals:
+            return less(b, a, true);
+        case Op::Equals: {
+            const auto d = apply_interval(Op::Sub, a, b);
+            return decided<F>(not d.nan and d.lo >= -1e-40 and d.hi <= 1e-40,
+                              d.lo > 1e-40 or d.hi < -1e-40);
+        }
+        case Op::Min:
+            return minimum(a, b, false);
+        case Op::Max:
+            return minimum(a, b, true);
+        case Op::Log:
+            return divide(apply_interval(Op::Ln, a), apply_interval(Op::Ln, b));
+        case Op::Gcd: {
+            constexpr F limit = std::numeric_limits<int>::max();
+            const auto m = std::max({std::abs(a.lo), std::abs(a.hi),
+                                     std::abs(b.lo), std::abs(b.hi)});
+            if (empty(a) or empty(b) or a.nan or b.nan or not(m < limit)) {
+                return entire<F>(true);
+            }
+            return {0, std::trunc(m)};
+        }
+        case Op::Lcm:
+            return entire<F>(a.nan or b.nan);
+        case Op::And:
+        case Op::Or: {
+            const auto p = truthiness(a), q = truthiness(b);
+            if (op == Op::And) {
+                return {std::min(p.lo, q.lo), std::min(p.hi, q.hi)};
+            }
+            return {std::max(p.lo, q.lo), std::max(p.hi, q.hi)};
+        }
+        case Op::Xor: {
+            constexpr F limit = std::numeric_limits<int>::max();
+            const auto m = std::max({std::abs(a.lo), std::abs(a.hi),
+                                     std::abs(b.lo), std::abs(b.hi)});
+            if (empty(a) or empty(b) or a.nan or b.nan or not(m < limit)) {
+                return entire<F>(true);
+            }
+            const auto x = std::trunc(a.lo), y = std::trunc(b.lo);
+            if (x == std::trunc(a.hi) and y == std::trunc(b.hi)) {
+                const auto value = apply(op, x, y);
+                return {value, value};
+            }
+            // both sides fit in the bits below `p`, and so does the result
+            auto p = F{1};
+            while (p <= m) {
+                p *= 2;
+            }
+            return {a.lo > -1 and b.lo > -1 ? F{0} : -p, p - 1};
+        }
+        default:
+            return a;
+    }
+}
+
+}  // namespace detail
+
+// Bounds the result of the program for every assignment of its variables
+// within `slots`. Every builtin is bounded outwards: the interval holds what
+// the program computes in floating point, not only the exact result. Like
+// `run_batch` it ignores the jumps and evaluates both branches of `if`,
+// taking their hull when the condition is not decided. An assignment a jump
+// may skip widens the variable to the hull of its old and new values.
+// Builtins of operands that hold one number each are computed exactly.
+template <class F>
+auto bound(const Program<F>& program, std::span<const Interval<F>> slots,
+           std::vector<Interval<F>>& values) -> Interval<F> {
+    using detail::apply_interval;
+
+    values.resize(program.code.size());
+    // the bounds of every variable at the current instruction
+    std::vector<Interval<F>> variables(slots.begin(), slots.end());
+    // instructions before `reach` may be jumped over
+    std::uint32_t reach = 0;
+
+    for (std::uint32_t i = 0; i < program.code.size(); ++i) {
+        const auto& instruction = program.code[i];
+        // jump targets and slots are not values
+        const auto operand = [&values](std::uint32_t index) {
+            return index < values.size() ? values[index] : Interval<F>{};
+        };
+        const auto a = operand(instruction.a), b = operand(instruction.b),
+                   c = operand(instruction.c);
+        auto& value = values[i];
+
+        switch (instruction.op) {
+            case Op::Const:
+                value = std::isnan(instruction.value)
+                            ? detail::nothing<F>()
+                            : Interval<F>{instruction.value, instruction.value};
+                break;
+            case Op::Load:
+                value = variables[instruction.a];
+                break;
+            case Op::Store:
+                value = b;
+                variables[instruction.a] =
+                    i < reach ? detail::hull(variables[instruction.a], b) : b;
+                break;
+            case Op::Jump:
+            case Op::JumpIf:
+            case Op::JumpUnless:
+                reach = std::max(reach, instruction.b);
+                break;
+            case Op::Select: {
+                const auto condition = detail::truthiness(a);
+                value = condition.lo == 1   ? b
+                        : condition.hi == 0 ? c
+                                            : detail::hull(b, c);
+                break;
+            }
+            case Op::Fma:
+                value = apply_interval(Op::Add, apply_interval(Op::Mul, a, b),
+                                       c);
+                break;
+            case Op::Rand:
+                value = {0, 1};
+                break;
+            case Op::Normal: {
+                const auto z = static_cast<F>(detail::normal_radius);
+                value = apply_interval(
+                    Op::Add, a, apply_interval(Op::Mul, b, Interval<F>{-z, z}));
+                break;
+            }
+            default: {
+                const auto unary = detail::is_unary(instruction.op);
+                if (detail::single(a) and (unary or detail::single(b))) {
+                    value = detail::apply_single(instruction.op, a, b);
+                } else {
+                    value = unary ? apply_interval(instruction.op, a)
+                                  : apply_interval(instruction.op, a, b);
+                }
+                break;
+            }
+        }
+    }
+
+    return values[program.result];
+}
+
+template <class F>
+auto bound(const Program<F>& program, std::span<const Interval<F>> slots)
+    -> Interval<F> {
+    std::vector<Interval<F>> values;
+    return bound(program, slots, values);
+}
+
+}  // namespace calc
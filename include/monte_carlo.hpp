@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+#include "prelude.hpp"
+#include "program.hpp"
+#include "random.hpp"
+#include "vm.hpp"
+
+namespace calc {
+
+// Probabilities of the quantiles `monte_carlo` reports.
+constexpr std::array<double, 7> monte_carlo_levels = {0.01, 0.05, 0.25, 0.5,
+                                                      0.75, 0.95, 0.99};
+
+// Number of results `monte_carlo` keeps to estimate quantiles from.
+constexpr std::size_t monte_carlo_kept = 1 << 16;
+
+// Distribution of the results of a program over many samples. Results that
+// are NaN are only counted in `undefined`.
+template <class F>
+struct MonteCarloSummary {
+    std::size_t samples = 0;
+    std::size_t undefined = 0;
+    F mean = 0;
+    F variance = 0;
+    F min = 0;
+    F max = 0;
+    std::array<F, monte_carlo_levels.size()> quantiles{};
+};
+
+template <class F>
+auto& operator<<(std::ostream& os, const MonteCarloSummary<F>& summary) {
+    os << "samples " << summary.samples << '\n'
+       << "undefined " << summary.undefined << '\n'
+       << "mean " << summary.mean << '\n'
+       << "variance " << summary.variance << '\n'
+       << "min " << summary.min << '\n'
+       << "max " << summary.max << '\n';
+
+    for (std::size_t i = 0; i < monte_carlo_levels.size(); ++i) {
+        os << 'p' << monte_carlo_levels[i] * 100 << ' '
+           << summary.quantiles[i] << '\n';
+    }
+    return os;
+}
+
+namespace detail {
+
+// Running count, mean and sum of squared deviations (Welford), merged by the
+// pairwise update of Chan et al.
+template <class F>
+struct Moments {
+    std::size_t count = 0;
+    F mean = 0;
+    F m2 = 0;
+
+    auto add(F value) -> void {
+        ++count;
+        const auto delta = value - mean;
+        mean += delta / static_cast<F>(count);
+        m2 += delta * (value - mean);
+    }
+
+    auto merge(const Moments& other) -> void {
+        if (other.count == 0) {
+            return;
+        }
+        const auto total = count + other.count;
+        const auto delta = other.mean - mean;
+        const auto weight = static_cast<F>(other.count) / static_cast<F>(total);
+
+        mean += delta * weight;
+        m2 += other.m2 + delta * delta * static_cast<F>(count) * weight;
+        count = total;
+    }
+};
+
+// Uniform sample without replacement of at most `size` results: every
+// result gets a random key and those with the smallest keys are kept. Keys
+// depend only on the seed and the sample index, so the kept results do not
+// depend on the order they are added or merged in.
+template <class F>
+class KeptResults {
+   public:
+    explicit KeptResults(std::size_t size) : _size(size) {}
+
+    auto add(Sample sample, F value) -> void {
+        // counter word 3 is 0 for the random builtins, this stream is apart
+        const auto bits = philox(
+            {static_cast<std::uint32_t>(sample.index),
+             static_cast<std::uint32_t>(sample.index >> 32), 0, 1},
+            {static_cast<std::uint32_t>(sample.seed),
+             static_cast<std::uint32_t>(sample.seed >> 32)});
+
+        _kept.emplace_back(std::uint64_t{bits[0]} << 32 | bits[1], value);
+        if (_kept.size() >= 2 * _size) {
+            trim();
+        }
+    }
+
+    auto merge(const KeptResults& other) -> void {
+        _kept.insert(_kept.end(), other._kept.begin(), other._kept.end());
+        trim();
+    }
+
+    // The kept results, in no particular order.
+    auto values() -> std::vector<F> {
+        trim();
+        std::vector<F> values(_kept.size());
+        std::ranges::transform(_kept, values.begin(),
+                               [](auto&& kept) { return kept.second; });
+        return values;
+    }
+
+   private:
+    auto trim() -> void {
+        if (_kept.size() > _size) {
+            std::nth_element(_kept.begin(), _kept.begin() + _size,
+                             _kept.end());
+            _kept.resize(_size);
+        }
+    }
+
+    std::size_t _size;
+    std::vector<std::pair<std::uint64_t, F>> _kept;
+};
+
+// Quantile `level` of the sorted order of `values` with linear interpolation
+// between the closest ranks. Partitions `values` from `from` on, every
+// element before `from` must already be in place.
+template <class F>
+auto quantile(std::span<F> values, std::size_t& from, double level) -> F {
+    const auto rank = level * static_cast<double>(values.size() - 1);
+    const auto lower = static_cast<std::size_t>(rank);
+
+    std::nth_element(values.begin() + from, values.begin() + lower,
+                     values.end());
+    from = lower;
+
+    if (lower + 1 == values.size()) {
+        return values[lower];
+    }
+
+    const auto upper = *std::min_element(values.begin() + lower + 1,
+                                         values.end());
+    const auto fraction = static_cast<F>(rank - static_cast<double>(lower));
+
+    return values[lower] + fraction * (upper - values[lower]);
+}
+
+}  // namespace detail
+
+// Evaluates a program of random builtins for samples 0 to `samples` - 1 of
+// `seed` on up to `jobs` threads. Samples are split into chunks evaluated in
+// batch mode, or a sample at a time on the VM for programs with assignments
+// a jump can skip, and the statistics of the chunks are merged in order, so
+// the summary does not depend on `jobs`. Quantiles are exact up to
+// `monte_carlo_kept` defined results and taken from a uniform sample of that
+// many beyond, which keeps memory bounded whatever `samples` is.
+template <class F>
+auto monte_carlo(const Program<F>& program, std::size_t samples,
+                 std::size_t jobs, std::uint64_t seed = 0,
+                 MathMode mode = MathMode::Exact)
+    -> std::optional<MonteCarloSummary<F>> {
+    std::vector<std::string_view> undefined;
+    const auto needed = detail::inputs(program);
+
+    for (std::size_t slot = 0; slot < needed.size(); ++slot) {
+        if (needed[slot]) {
+            undefined.push_back(program.names[slot]);
+        }
+    }
+
+    ASSERT(undefined.empty(),
+           "Undefined variables " << detail::make_delimited_print(undefined));
+    ASSERT(samples > 0, "No samples to evaluate");
+
+    constexpr auto chunk = 64 * batch_block;
+    const auto chunks = (samples + chunk - 1) / chunk;
+    // more threads than cores only add switching, more than chunks idle
+    const auto threads = std::min(
+        {std::max<std::size_t>(jobs, 1), chunks,
+         4 * std::max<std::size_t>(std::thread::hardware_concurrency(), 1)});
+
+    std::vector<detail::Moments<F>> moments(chunks);
+    std::vector<detail::KeptResults<F>> kept(
+        threads, detail::KeptResults<F>(monte_carlo_kept));
+    std::vector<std::pair<F, F>> extremes(threads, {INFINITY, -INFINITY});
+    std::vector<const F*> columns(program.names.size());
+    std::atomic<std::size_t> next = 0;
+
+    // programs batch mode rejects fall back to the VM, or the interpreter
+    // when they do not fit it
+    const auto batched = detail::stored(program).has_value();
+    const auto vm = batched ? std::nullopt : assemble(program);
+
+    const auto evaluate = [&](F* out, std::size_t rows, std::size_t begin) {
+        if (batched) {
+            run_batch(program, std::span<const F* const>(columns), out, rows,
+                      mode, Sample{seed, begin});
+            return;
+        }
+
+        std::vector<F> slots(program.names.size()), values;
+        for (std::size_t row = 0; row < rows; ++row) {
+            const Sample sample{seed, begin + row};
+            out[row] = vm ? run(*vm, std::span(slots), sample)
+                          : run(program, std::span(slots), values, sample);
+        }
+    };
+
+    const auto work = [&](std::size_t job) {
+        std::vector<F> out(chunk);
+        auto& [min, max] = extremes[job];
+
+        for (auto i = next++; i < chunks; i = next++) {
+            const auto begin = i * chunk;
+            const auto rows = std::min(chunk, samples - begin);
+
+            evaluate(out.data(), rows, begin);
+
+            for (std::size_t row = 0; row < rows; ++row) {
+                if (std::isnan(out[row])) {
+                    continue;
+                }
+                moments[i].add(out[row]);
+                kept[job].add(Sample{seed, begin + row}, out[row]);
+                min = std::min(min, out[row]);
+                max = std::max(max, out[row]);
+            }
+        }
+    };
+
+    std::string failed;
+    {
+        std::vector<std::jthread> workers;
+        try {
+            for (std::size_t job = 1; job < threads; ++job) {
+                workers.emplace_back(work, job);
+            }
+        } catch (const std::system_error& error) {
+            // the threads already running stop after their current chunk
+            next = chunks;
+            failed = error.what();
+        }
+        if (failed.empty()) {
+            work(0);
+        }
+    }
+
+    ASSERT(failed.empty(), "Cannot start a thread: " << failed);
+
+    detail::Moments<F> total;
+    for (auto&& chunk_moments : moments) {
+        total.merge(chunk_moments);
+    }
+
+    MonteCarloSummary<F> summary;
+    summary.samples = samples;
+    summary.undefined = samples - total.count;
+
+    if (total.count == 0) {
+        summary.mean = summary.variance = summary.min = summary.max = NAN;
+        summary.quantiles.fill(NAN);
+        return summary;
+    }
+
+    summary.mean = total.mean;
+    summary.variance =
+        total.count > 1 ? total.m2 / static_cast<F>(total.count - 1) : F{0};
+
+    summary.min = INFINITY;
+    summary.max = -INFINITY;
+    for (auto&& [min, max] : extremes) {
+        summary.min = std::min(summary.min, min);
+        summary.max = std::max(summary.max, max);
+    }
+
+    for (std::size_t job = 1; job < threads; ++job) {
+        kept[0].merge(kept[job]);
+    }
+    auto values = kept[0].values();
+
+    std::size_t from = 0;
+    for (std::size_t i = 0; i < monte_carlo_levels.size(); ++i) {
+        summary.quantiles[i] =
+            detail::quantile(std::span(values), from, monte_carlo_levels[i]);
+    }
+
+    return summary;
+}
+
+}  // namespace calc
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <lexer.hpp>
+#include <span>
 #include <vector>
 
 #include "prelude.hpp"
@@ -42,16 +43,17 @@ constexpr auto precedence(const Token<It>& token) {
     }
 }
 
-template <class It>
-constexpr auto is_function(const Token<It>& token, It begin, It end) -> bool {
+// `next` yields the type of the token following the one being parsed.
+template <class It, class Next>
+constexpr auto is_function(const Token<It>& token, Next&& next) -> bool {
     if (token.type != Token<It>::Identifier) {
         return false;
     }
 
-    const auto next = next_token(begin, end).type;
+    const auto type = next();
 
-    return next == Token<It>::OpenParen or next == Token<It>::Identifier or
-           next == Token<It>::Number;
+    return type == Token<It>::OpenParen or type == Token<It>::Identifier or
+           type == Token<It>::Number;
 }
 
 template <class It>
@@ -59,21 +61,22 @@ constexpr auto is_binary_operator(const Token<It>& token) -> bool {
     return token.type >= Token<It>::Add and token.type <= Token<It>::Equals;
 }
 
-template <class It, class Queue>
-constexpr auto parse_token(const Token<It>& token, It begin, It end,
+template <class It, class Next, class Queue>
+constexpr auto parse_token(const Token<It>& token, Next&& next,
                            Queue& operators, Queue& output)
     -> std::optional<bool> {
     using val = std::iter_value_t<It>;
     using str_view = typename std::basic_string_view<val>;
 
     ASSERT(token.type != Token<It>::Error,
-           "Tokenizer error at: `" << str_view(begin, end) << "`");
+           "Tokenizer error at: `"
+               << str_view(token.lexeme_start, token.lexeme_end) << "`");
 
     if (token.type == Token<It>::EndOfFile) {
         return false;
     }
 
-    else if (is_function(token, begin, end) or
+    else if (is_function(token, next) or
              token.type == Token<It>::OpenParen) {
         operators.push_back(token);
     }
@@ -121,7 +124,7 @@ constexpr auto parse_token(const Token<It>& token, It begin, It end,
         operators.pop_back();
 
         if (not operators.empty() and
-            is_function(operators.back(), begin, end)) {
+            is_function(operators.back(), next)) {
             output.push_back(operators.back());
             operators.pop_back();
         }
@@ -152,9 +155,41 @@ constexpr auto parse(It begin, It end)
     std::vector<Token<It>> output;
     std::vector<Token<It>> operators;
 
+    const auto next = [&begin, end] { return peek_token(begin, end).type; };
+
     for (;;) {
         const auto parsed =
-            parse_token(next_token(begin, end), begin, end, operators, output);
+            parse_token(next_token(begin, end), next, operators, output);
+
+        if (not parsed) {
+            return std::nullopt;
+        }
+        if (not*parsed) {
+            break;
+        }
+    }
+
+    pull_parens<It>(operators, output);
+
+    return output;
+}
+
+// Same as above for input that is already split into tokens.
+template <class It>
+constexpr auto parse(std::span<const Token<It>> tokens)
+    -> std::optional<std::vector<Token<It>>> {
+    using namespace detail;
+
+    std::vector<Token<It>> output;
+    std::vector<Token<It>> operators;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        const auto next = [&tokens, i] {
+            return i + 1 < tokens.size() ? tokens[i + 1].type
+                                         : Token<It>::EndOfFile;
+        };
+
+        const auto parsed = parse_token(tokens[i], next, operators, output);
 
         if (not parsed) {
             return std::nullopt;
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "evaluator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "prelude.hpp"
+
+namespace calc {
+
+// Bounded single producer single consumer queue. `push` blocks while the
+// queue is full, which is what throttles a stage running ahead of the next.
+// Either side may `close` it: pushes then fail and pops fail once drained.
+//
+// Every change bumps `_events`, a side that has to block waits for it to move
+// past the value it read before checking the queue, so no wakeup is lost.
+template <class T, std::uint32_t capacity = 16>
+class SpscQueue {
+    static_assert((capacity & (capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+   public:
+    auto push(T value) -> bool {
+        const auto tail = _tail.load(std::memory_order_relaxed);
+
+        for (;;) {
+            const auto events = _events.load(std::memory_order_acquire);
+            if (_closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (tail - _head.load(std::memory_order_acquire) < capacity) {
+                break;
+            }
+            _events.wait(events, std::memory_order_acquire);
+        }
+
+        _items[tail % capacity] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        signal();
+
+        return true;
+    }
+
+    auto pop() -> std::optional<T> {
+        const auto head = _head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            const auto events = _events.load(std::memory_order_acquire);
+            if (_tail.load(std::memory_order_acquire) != head) {
+                break;
+            }
+            if (_closed.load(std::memory_order_acquire)) {
+                return std::nullopt;
+            }
+            _events.wait(events, std::memory_order_acquire);
+        }
+
+        auto value = std::move(_items[head % capacity]);
+        _head.store(head + 1, std::memory_order_release);
+        signal();
+
+        return value;
+    }
+
+    auto close() -> void {
+        _closed.store(true, std::memory_order_release);
+        signal();
+    }
+
+    auto closed() const -> bool {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+   private:
+    auto signal() -> void {
+        _events.fetch_add(1, std::memory_order_acq_rel);
+        _events.notify_all();
+    }
+
+    alignas(64) std::atomic<std::uint32_t> _head = 0;
+    alignas(64) std::atomic<std::uint32_t> _tail = 0;
+    alignas(64) std::atomic<std::uint32_t> _events = 0;
+    std::atomic<bool> _closed = false;
+    std::array<T, capacity> _items;
+};
+
+template <class T>
+class Generator {
+   public:
+    struct promise_type {
+        const T* current = nullptr;
+        std::exception_ptr exception;
+
+        auto get_return_object() -> Generator {
+            return Generator(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        auto initial_suspend() noexcept { return std::suspend_always{}; }
+        auto final_suspend() noexcept { return std::suspend_always{}; }
+        auto yield_value(const T& value) noexcept {
+            current = std::addressof(value);
+            return std::suspend_always{};
+        }
+        auto return_void() -> void {}
+        auto unhandled_exception() -> void {
+            exception = std::current_exception();
+        }
+    };
+
+    class iterator {
+       public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        auto operator*() const -> const T& {
+            return *_handle.promise().current;
+        }
+        auto operator++() -> iterator& {
+            resume(_handle);
+            return *this;
+        }
+        auto operator++(int) -> void { ++*this; }
+        auto operator==(std::default_sentinel_t) const -> bool {
+            return _handle.done();
+        }
+
+       private:
+        friend Generator;
+        explicit iterator(std::coroutine_handle<promise_type> handle)
+            : _handle(handle) {}
+
+        std::coroutine_handle<promise_type> _handle;
+    };
+
+    Generator(Generator&& other) noexcept
+        : _handle(std::exchange(other._handle, nullptr)) {}
+    Generator(const Generator&) = delete;
+    auto operator=(const Generator&) -> Generator& = delete;
+    auto operator=(Generator&&) -> Generator& = delete;
+
+    ~Generator() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    auto begin() -> iterator {
+        resume(_handle);
+        return iterator(_handle);
+    }
+    auto end() -> std::default_sentinel_t { return {}; }
+
+   private:
+    explicit Generator(std::coroutine_handle<promise_type> handle)
+        : _handle(handle) {}
+
+    static auto resume(std::coroutine_handle<promise_type> handle) -> void {
+        handle.resume();
+        if (handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+    }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail {
+
+using stream_token = Token<const char*>;
+
+// Lines read from the input together with their tokens. The text is kept
+// behind a pointer so tokens stay valid while the batch moves downstream.
+struct LexedBatch {
+    std::unique_ptr<std::string> text;
+    std::vector<stream_token> tokens;
+    std::vector<std::size_t> ends;
+};
+
+struct ParsedBatch {
+    std::unique_ptr<std::string> text;
+    std::vector<std::optional<std::vector<stream_token>>> queues;
+};
+
+template <class F>
+using result_batch = std::vector<std::optional<F>>;
+
+template <class F, class Vars>
+class Stages {
+   public:
+    Stages(std::istream& input, Vars& variables, std::size_t lines)
+        : _lexer([this, &input, lines] { lex(input, lines); }),
+          _parser([this] { parse(); }),
+          _evaluator([this, &variables] { evaluate(variables); }) {}
+
+    Stages(const Stages&) = delete;
+    auto operator=(const Stages&) -> Stages& = delete;
+
+    // Stops the stages when the consumer goes away before the input ends.
+    // A lexer blocked reading the input stops once that read returns, so
+    // this waits for the next line or the end of the input.
+    ~Stages() {
+        _lexed.close();
+        _parsed.close();
+        _results.close();
+    }
+
+    auto results() -> SpscQueue<result_batch<F>>& { return _results; }
+
+   private:
+    auto lex(std::istream& input, std::size_t lines) -> void {
+        for (bool more = true; more;) {
+            LexedBatch batch{std::make_unique<std::string>(), {}, {}};
+            std::vector<std::size_t> offsets;
+            std::string line;
+
+            // stop reading at once when the consumer has gone away
+            while (offsets.size() < lines and not _lexed.closed() and
+                   (more = static_cast<bool>(std::getline(input, line)))) {
+                if (line.empty()) {
+                    continue;
+                }
+                offsets.push_back(batch.text->size());
+                batch.text->append(line).push_back('\n');
+            }
+
+            const auto* base = batch.text->data();
+            for (std::size_t i = 0; i < offsets.size(); ++i) {
+                const auto* begin = base + offsets[i];
+                const auto* end = (i + 1 < offsets.size())
+                                      ? base + offsets[i + 1] - 1
+                                      : base + batch.text->size() - 1;
+
+                lex_all(begin, end, [&batch](const stream_token& token) {
+                    batch.tokens.push_back(token);
+                    return token.type != TokenType::Error;
+                });
+                batch.ends.push_back(batch.tokens.size());
+            }
+
+            if (_lexed.closed() or
+                (not offsets.empty() and not _lexed.push(std::move(batch)))) {
+                return;
+            }
+        }
+        _lexed.close();
+    }
+
+    auto parse() -> void {
+        while (auto lexed = _lexed.pop()) {
+            ParsedBatch batch{std::move(lexed->text), {}};
+            const std::span<const stream_token> tokens = lexed->tokens;
+
+            std::size_t begin = 0;
+            for (const auto end : lexed->ends) {
+                batch.queues.push_back(
+                    calc::parse(tokens.subspan(begin, end - begin)));
+                begin = end;
+            }
+
+            if (not _parsed.push(std::move(batch))) {
+                return;
+            }
+        }
+        _parsed.close();
+    }
+
+    auto evaluate(Vars& variables) -> void {
+        while (auto parsed = _parsed.pop()) {
+            result_batch<F> batch;
+            batch.reserve(parsed->queues.size());
+
+            for (auto&& queue : parsed->queues) {
+                batch.push_back(queue ? execute<F, const char*>(*queue,
+                                                                 variables)
+                                      : std::nullopt);
+            }
+
+            if (not _results.push(std::move(batch))) {
+                return;
+            }
+        }
+        _results.close();
+    }
+
+    SpscQueue<LexedBatch> _lexed;
+    SpscQueue<ParsedBatch> _parsed;
+    SpscQueue<result_batch<F>> _results;
+
+    // declared last so the queues outlive the threads joining on destruction
+    std::jthread _lexer, _parser, _evaluator;
+};
+
+}  // namespace detail
+
+// Evaluates every non-empty line of `input`, lexing, parsing and evaluating
+// on three threads connected by bounded queues. Results are yielded in input
+// order. `variables` belongs to the evaluating thread until the generator is
+// exhausted or destroyed. Destroying it early waits for a read of `input` in
+// progress to return, which on interactive input means the next line.
+template <class F>
+auto stream(std::istream& input,
+            variables_handle<F, const char*> auto& variables,
+            std::size_t lines = 256) -> Generator<std::optional<F>> {
+    detail::Stages<F, std::remove_reference_t<decltype(variables)>> stages(
+        input, variables, lines);
+
+    while (auto batch = stages.results().pop()) {
+        for (auto&& result : *batch) {
+            co_yield result;
+        }
+    }
+}
+
+}  // namespace calc
@@ -0,0 +1,978 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "evaluator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "prelude.hpp"
+#include "random.hpp"
+#include "variables.hpp"
+
+namespace calc {
+
+// Operations of a compiled program. Builtins are resolved once at compile
+// time instead of by name on every evaluation.
+enum class Op : std::uint8_t {
+    Const,
+    Load,
+    Store,
+    Jump,
+    JumpIf,
+    JumpUnless,
+
+    Sqrt,
+    Cbrt,
+    Abs,
+    Ln,
+    Lg,
+    Exp,
+    Ceil,
+    Floor,
+    Round,
+    Trunc,
+    Sin,
+    Asin,
+    Sinh,
+    Asinh,
+    Cos,
+    Acos,
+    Cosh,
+    Acosh,
+    Tan,
+    Atan,
+    Tanh,
+    Atanh,
+
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Pow,
+    LessThan,
+    LessEquals,
+    GreaterThan,
+    GreaterEquals,
+    Equals,
+    Min,
+    Max,
+    Log,
+    Gcd,
+    Lcm,
+    And,
+    Or,
+    Xor,
+
+    Select,
+    Fma,
+
+    Rand,
+    Normal,
+};
+
+// Single instruction in SSA form: the result of the instruction at index `i`
+// is value `i`. `a`, `b` and `c` are indices of operand values, `Load` and
+// `Store` keep the variable slot in `a` and `Store` keeps the stored value in
+// `b`. Jumps continue at the instruction with index `b`, the conditional ones
+// test value `a` and produce no value themselves. Random builtins keep the
+// index of the stream they draw from in `c`.
+template <class F>
+struct Instruction {
+    Op op;
+    std::uint32_t a = 0, b = 0, c = 0;
+    F value = 0;
+};
+
+template <class F>
+struct Program {
+    std::vector<Instruction<F>> code;
+    std::vector<std::string> names;
+    std::uint32_t result = 0;
+};
+
+namespace detail {
+
+constexpr auto is_unary(Op op) -> bool {
+    return op >= Op::Sqrt and op <= Op::Atanh;
+}
+
+constexpr auto is_binary(Op op) -> bool {
+    return op >= Op::Add and op <= Op::Xor;
+}
+
+constexpr auto is_ternary(Op op) -> bool {
+    return op == Op::Select or op == Op::Fma;
+}
+
+constexpr auto is_random(Op op) -> bool {
+    return op == Op::Rand or op == Op::Normal;
+}
+
+constexpr auto is_jump(Op op) -> bool {
+    return op == Op::Jump or op == Op::JumpIf or op == Op::JumpUnless;
+}
+
+// Truth value used by `and`, `or` and `if`.
+template <class F>
+constexpr auto truthy(F value) -> bool {
+    return static_cast<int>(value);
+}
+
+// Calls `fn` with a reference to every operand value of the instruction.
+template <class I, class Fn>
+constexpr auto for_each_operand(I& instruction, Fn fn) -> void {
+    const auto op = instruction.op;
+
+    if (op == Op::Store) {
+        fn(instruction.b);
+    } else if (op == Op::JumpIf or op == Op::JumpUnless or is_unary(op)) {
+        fn(instruction.a);
+    } else if (is_binary(op) or op == Op::Normal) {
+        fn(instruction.a);
+        fn(instruction.b);
+    } else if (is_ternary(op)) {
+        fn(instruction.a);
+        fn(instruction.b);
+        fn(instruction.c);
+    }
+}
+
+template <class C>
+constexpr auto unary_op(std::basic_string_view<C> name) -> std::optional<Op> {
+    if (name == "sqrt") {
+        return Op::Sqrt;
+    } else if (name == "cbrt") {
+        return Op::Cbrt;
+    } else if (name == "abs") {
+        return Op::Abs;
+    } else if (name == "ln") {
+        return Op::Ln;
+    } else if (name == "lg") {
+        return Op::Lg;
+    } else if (name == "exp") {
+        return Op::Exp;
+    } else if (name == "ceil") {
+        return Op::Ceil;
+    } else if (name == "floor") {
+        return Op::Floor;
+    } else if (name == "round") {
+        return Op::Round;
+    } else if (name == "trunc") {
+        return Op::Trunc;
+    } else if (name == "sin") {
+        return Op::Sin;
+    } else if (name == "asin") {
+        return Op::Asin;
+    } else if (name == "sinh") {
+        return Op::Sinh;
+    } else if (name == "asinh") {
+        return Op::Asinh;
+    } else if (name == "cos") {
+        return Op::Cos;
+    } else if (name == "acos") {
+        return Op::Acos;
+    } else if (name == "cosh") {
+        return Op::Cosh;
+    } else if (name == "acosh") {
+        return Op::Acosh;
+    } else if (name == "tan") {
+        return Op::Tan;
+    } else if (name == "atan") {
+        return Op::Atan;
+    } else if (name == "tanh") {
+        return Op::Tanh;
+    } else if (name == "atanh") {
+        return Op::Atanh;
+    }
+    return std::nullopt;
+}
+
+template <class It>
+constexpr auto binary_op(TokenType type, str_view<It> name)
+    -> std::optional<Op> {
+    switch (type) {
+        case TokenType::Add:
+            return Op::Add;
+        case TokenType::Sub:
+            return Op::Sub;
+        case TokenType::Mul:
+            return Op::Mul;
+        case TokenType::Div:
+            return Op::Div;
+        case TokenType::Mod:
+            return Op::Mod;
+        case TokenType::Pow:
+            return Op::Pow;
+        case TokenType::LessThan:
+            return Op::LessThan;
+        case TokenType::LessEquals:
+            return Op::LessEquals;
+        case TokenType::GreaterThan:
+            return Op::GreaterThan;
+        case TokenType::GreaterEquals:
+            return Op::GreaterEquals;
+        case TokenType::Equals:
+            return Op::Equals;
+        default:
+            break;
+    }
+
+    if (name == "min") {
+        return Op::Min;
+    } else if (name == "max") {
+        return Op::Max;
+    } else if (name == "log") {
+        return Op::Log;
+    } else if (name == "gcd") {
+        return Op::Gcd;
+    } else if (name == "lcm") {
+        return Op::Lcm;
+    } else if (name == "or") {
+        return Op::Or;
+    } else if (name == "and") {
+        return Op::And;
+    } else if (name == "xor") {
+        return Op::Xor;
+    } else if (name == "add") {
+        return Op::Add;
+    } else if (name == "sub") {
+        return Op::Sub;
+    } else if (name == "div") {
+        return Op::Div;
+    } else if (name == "mul") {
+        return Op::Mul;
+    } else if (name == "mod") {
+        return Op::Mod;
+    } else if (name == "pow") {
+        return Op::Pow;
+    }
+    return std::nullopt;
+}
+
+template <class C>
+constexpr auto ternary_op(std::basic_string_view<C> name)
+    -> std::optional<Op> {
+    if (name == "if") {
+        return Op::Select;
+    }
+    return std::nullopt;
+}
+
+template <class F>
+constexpr auto apply(Op op, F a) -> F {
+    switch (op) {
+        case Op::Sqrt:
+            return std::sqrt(a);
+        case Op::Cbrt:
+            return std::cbrt(a);
+        case Op::Abs:
+            return std::fabs(a);
+        case Op::Ln:
+            return std::log(a);
+        case Op::Lg:
+            return std::log10(a);
+        case Op::Exp:
+            return std::exp(a);
+        case Op::Ceil:
+            return std::ceil(a);
+        case Op::Floor:
+            return std::floor(a);
+        case Op::Round:
+            return std::round(a);
+        case Op::Trunc:
+            return std::trunc(a);
+        case Op::Sin:
+            return std::sin(a);
+        case Op::Asin:
+            return std::asin(a);
+        case Op::Sinh:
+            return std::sinh(a);
+        case Op::Asinh:
+            return std::asinh(a);
+        case Op::Cos:
+            return std::cos(a);
+        case Op::Acos:
+            return std::acos(a);
+        case Op::Cosh:
+            return std::cosh(a);
+        case Op::Acosh:
+            return std::acosh(a);
+        case Op::Tan:
+            return std::tan(a);
+        case Op::Atan:
+            return std::atan(a);
+        case Op::Tanh:
+            return std::tanh(a);
+        case Op::Atanh:
+            return std::atanh(a);
+        default:
+            return a;
+    }
+}
+
+template <class F>
+constexpr auto apply(Op op, F a, F b) -> F {
+    switch (op) {
+        case Op::Add:
+            return a + b;
+        case Op::Sub:
+            return a - b;
+        case Op::Mul:
+            return a * b;
+        case Op::Div:
+            return a / b;
+        case Op::Mod:
+            return std::fmod(a, b);
+        case Op::Pow:
+            return std::pow(a, b);
+        case Op::LessThan:
+            return a < b;
+        case Op::LessEquals:
+            return a <= b;
+        case Op::GreaterThan:
+            return a > b;
+        case Op::GreaterEquals:
+            return a >= b;
+        case Op::Equals:
+            return std::abs(a - b) <= 1e-40;
+        case Op::Min:
+            return std::min(a, b);
+        case Op::Max:
+            return std::max(a, b);
+        case Op::Log:
+            return std::log(a) / std::log(b);
+        case Op::Gcd:
+            return std::gcd(static_cast<int>(a), static_cast<int>(b));
+        case Op::Lcm:
+            return std::lcm(static_cast<int>(a), static_cast<int>(b));
+        case Op::And:
+            return truthy(a) and truthy(b);
+        case Op::Or:
+            return truthy(a) or truthy(b);
+        case Op::Xor:
+            // bitwise like the token evaluator, xor(4, 2) is 6
+            return static_cast<int>(a) ^ static_cast<int>(b);
+        default:
+            return a;
+    }
+}
+
+template <class F>
+constexpr auto select(F condition, F then, F otherwise) -> F {
+    return truthy(condition) ? then : otherwise;
+}
+
+template <class F>
+constexpr auto apply(Op op, F a, F b, F c) -> F {
+    switch (op) {
+        case Op::Select:
+            return select(a, b, c);
+        case Op::Fma:
+            return std::fma(a, b, c);
+        default:
+            return a;
+    }
+}
+
+template <class F>
+auto emit(Program<F>& program, Instruction<F> instruction) -> std::uint32_t {
+    program.code.push_back(instruction);
+    return static_cast<std::uint32_t>(program.code.size() - 1);
+}
+
+template <class F>
+auto slot(Program<F>& program, std::string_view name) -> std::uint32_t {
+    const auto found = std::ranges::find(program.names, name);
+    if (found != program.names.end()) {
+        return static_cast<std::uint32_t>(found - program.names.begin());
+    }
+    program.names.emplace_back(name);
+    return static_cast<std::uint32_t>(program.names.size() - 1);
+}
+
+// Orders the instructions the result depends on for evaluation, dropping
+// the rest along with the variables only they used. Operands that may go
+// unused are placed behind conditional jumps: the right side of `and` and
+// `or` and both branches of `if`. The join instruction after them reads only
+// the operands that were evaluated.
+//
+// Every skippable operand gets a region of its own. A value is reused where
+// the region that computed it encloses the current one, otherwise it is
+// computed again, so no instruction reads a value a jump may have skipped.
+template <class F>
+class Lowering {
+    static constexpr auto none = UINT32_MAX;
+
+    struct Emitted {
+        std::uint32_t index = none;
+        std::uint32_t region = 0;
+    };
+
+   public:
+    explicit Lowering(const Program<F>& eager)
+        : _eager(eager), _emitted(eager.code.size()) {}
+
+    auto operator()() -> Program<F> {
+        _program.result = add(_eager.result);
+        return release();
+    }
+
+    // Lowers what the value `root` depends on, returns its lowered index.
+    auto add(std::uint32_t root) -> std::uint32_t { return lower(root, 0); }
+
+    auto release() -> Program<F> { return std::move(_program); }
+
+   private:
+    auto lower(std::uint32_t i, std::uint32_t region) -> std::uint32_t {
+        if (const auto emitted = _emitted[i];
+            emitted.index != none and encloses(emitted.region, region)) {
+            return emitted.index;
+        }
+
+        auto instruction = _eager.code[i];
+
+        switch (instruction.op) {
+            case Op::And:
+            case Op::Or: {
+                instruction.a = lower(instruction.a, region);
+                const auto skip = emit(
+                    _program,
+                    {instruction.op == Op::And ? Op::JumpUnless : Op::JumpIf,
+                     instruction.a});
+                instruction.b = lower(instruction.b, branch(region));
+                target(skip);
+                break;
+            }
+            case Op::Select: {
+                instruction.a = lower(instruction.a, region);
+                const auto skip_then =
+                    emit(_program, {Op::JumpUnless, instruction.a});
+                instruction.b = lower(instruction.b, branch(region));
+                const auto skip_else = emit(_program, {Op::Jump});
+                target(skip_then);
+                instruction.c = lower(instruction.c, branch(region));
+                target(skip_else);
+                break;
+            }
+            case Op::Load:
+                instruction.a = slot(_program, _eager.names[instruction.a]);
+                break;
+            case Op::Store:
+                instruction.b = lower(instruction.b, region);
+                instruction.a = slot(_program, _eager.names[instruction.a]);
+                break;
+            default:
+                for_each_operand(instruction, [&](std::uint32_t& operand) {
+                    operand = lower(operand, region);
+                });
+                break;
+        }
+
+        const auto index = emit(_program, instruction);
+        _emitted[i] = {index, region};
+        return index;
+    }
+
+    auto branch(std::uint32_t region) -> std::uint32_t {
+        _parents.push_back(region);
+        return static_cast<std::uint32_t>(_parents.size() - 1);
+    }
+
+    auto encloses(std::uint32_t outer, std::uint32_t inner) const -> bool {
+        while (inner != outer and inner != 0) {
+            inner = _parents[inner];
+        }
+        return inner == outer;
+    }
+
+    // Points the jump at the instruction emitted next.
+    auto target(std::uint32_t jump) -> void {
+        _program.code[jump].b =
+            static_cast<std::uint32_t>(_program.code.size());
+    }
+
+    const Program<F>& _eager;
+    Program<F> _program;
+    std::vector<Emitted> _emitted;
+    std::vector<std::uint32_t> _parents{0};
+};
+
+// Copies the program without its jumps, so every operand is evaluated. Passes
+// rewriting a program work on this form and lower the result again.
+template <class F>
+auto strip(const Program<F>& program) -> Program<F> {
+    Program<F> eager;
+    eager.names = program.names;
+    std::vector<std::uint32_t> index(program.code.size());
+
+    for (std::size_t i = 0; i < program.code.size(); ++i) {
+        auto instruction = program.code[i];
+        if (is_jump(instruction.op)) {
+            continue;
+        }
+        for_each_operand(instruction, [&](std::uint32_t& operand) {
+            operand = index[operand];
+        });
+        index[i] = emit(eager, instruction);
+    }
+
+    eager.result = index[program.result];
+    return eager;
+}
+
+// Whether the program may read each slot before assigning it, so the slot
+// needs a value from the caller. An assignment a jump can skip leaves the
+// slot needed by the loads after it.
+template <class F>
+auto inputs(const Program<F>& program) -> std::vector<bool> {
+    std::vector<bool> needed(program.names.size());
+    std::vector<bool> assigned(program.names.size());
+    // instructions before `reach` may be jumped over
+    std::uint32_t reach = 0;
+
+    for (std::uint32_t i = 0; i < program.code.size(); ++i) {
+        const auto& instruction = program.code[i];
+
+        if (is_jump(instruction.op)) {
+            reach = std::max(reach, instruction.b);
+        } else if (instruction.op == Op::Load) {
+            needed[instruction.a] = needed[instruction.a] or
+                                    not assigned[instruction.a];
+        } else if (instruction.op == Op::Store and i >= reach) {
+            assigned[instruction.a] = true;
+        }
+    }
+
+    return needed;
+}
+
+// The slots every run of the program assigns, or nothing when a jump can
+// skip an assignment and the slots assigned depend on the values.
+template <class F>
+auto stored(const Program<F>& program) -> std::optional<std::vector<bool>> {
+    std::vector<bool> assigned(program.names.size());
+    std::uint32_t reach = 0;
+
+    for (std::uint32_t i = 0; i < program.code.size(); ++i) {
+        const auto& instruction = program.code[i];
+
+        if (is_jump(instruction.op)) {
+            reach = std::max(reach, instruction.b);
+        } else if (instruction.op == Op::Store) {
+            if (i < reach) {
+                return std::nullopt;
+            }
+            assigned[instruction.a] = true;
+        }
+    }
+
+    return assigned;
+}
+
+// Rebuilds an eager program replacing every instruction whose operands are
+// all known by a constant, and every `if` with a known condition by the
+// branch it takes. `known(name)` gives the values of bound variables, which
+// stay free from the first assignment to them on.
+template <class F, class Known>
+auto fold(const Program<F>& eager, Known known) -> Program<F> {
+    Program<F> folded;
+    folded.names = eager.names;
+    // an eager program runs in order, so loads before the first store of a
+    // slot read the value it had on entry
+    std::vector<bool> assigned(eager.names.size());
+
+    const auto constant = [&folded](std::uint32_t i) -> std::optional<F> {
+        const auto& instruction = folded.code[i];
+        if (instruction.op != Op::Const) {
+            return std::nullopt;
+        }
+        return instruction.value;
+    };
+
+    std::vector<std::uint32_t> index(eager.code.size());
+
+    for (std::size_t i = 0; i < eager.code.size(); ++i) {
+        auto instruction = eager.code[i];
+        for_each_operand(instruction, [&](std::uint32_t& operand) {
+            operand = index[operand];
+        });
+
+        const auto op = instruction.op;
+        std::optional<F> value;
+
+        if (op == Op::Load and not assigned[instruction.a]) {
+            value = known(std::string_view(eager.names[instruction.a]));
+        } else if (op == Op::Store) {
+            assigned[instruction.a] = true;
+        } else if (op == Op::Select) {
+            if (const auto condition = constant(instruction.a)) {
+                index[i] = truthy(*condition) ? instruction.b : instruction.c;
+                continue;
+            }
+        } else if (op == Op::And or op == Op::Or) {
+            // the right side is skipped when the left one decides
+            if (const auto lhs = constant(instruction.a);
+                lhs and truthy(*lhs) == (op == Op::Or)) {
+                value = op == Op::Or;
+            }
+        }
+
+        if (not value and (is_unary(op) or is_binary(op) or is_ternary(op))) {
+            const auto a = constant(instruction.a);
+            const auto b = constant(instruction.b);
+
+            if (is_unary(op) and a) {
+                value = apply(op, *a);
+            } else if (is_binary(op) and a and b) {
+                value = apply(op, *a, *b);
+            } else if (const auto c = constant(instruction.c);
+                       is_ternary(op) and a and b and c) {
+                value = apply(op, *a, *b, *c);
+            }
+        }
+
+        index[i] = value ? emit(folded, {Op::Const, 0, 0, 0, *value})
+                         : emit(folded, instruction);
+    }
+
+    folded.result = index[eager.result];
+    return folded;
+}
+
+// Evaluates the program, calling `stored(slot, value)` for every assignment
+// that is executed. Random builtins draw the numbers of `sample`.
+template <class F, class Fn>
+auto interpret(const Program<F>& program, std::span<F> slots,
+               std::vector<F>& values, Fn stored, Sample sample) -> F {
+    values.resize(program.code.size());
+
+    for (std::size_t i = 0; i < program.code.size();) {
+        const auto& instruction = program.code[i];
+
+        switch (instruction.op) {
+            case Op::Const:
+                values[i] = instruction.value;
+                break;
+            case Op::Load:
+                values[i] = slots[instruction.a];
+                break;
+            case Op::Store:
+                values[i] = slots[instruction.a] = values[instruction.b];
+                stored(instruction.a, values[i]);
+                break;
+            case Op::Jump:
+                i = instruction.b;
+                continue;
+            case Op::JumpIf:
+            case Op::JumpUnless:
+                if (truthy(values[instruction.a]) ==
+                    (instruction.op == Op::JumpIf)) {
+                    i = instruction.b;
+                    continue;
+                }
+                break;
+            case Op::Rand:
+                values[i] = uniform<F>(sample, instruction.c);
+                break;
+            case Op::Normal:
+                values[i] =
+                    normal(sample, instruction.c, values[instruction.a],
+                           values[instruction.b]);
+                break;
+            default:
+                if (is_unary(instruction.op)) {
+                    values[i] = apply(instruction.op, values[instruction.a]);
+                } else if (is_binary(instruction.op)) {
+                    values[i] = apply(instruction.op, values[instruction.a],
+                                      values[instruction.b]);
+                } else {
+                    values[i] = apply(instruction.op, values[instruction.a],
+                                      values[instruction.b],
+                                      values[instruction.c]);
+                }
+                break;
+        }
+        ++i;
+    }
+
+    return values[program.result];
+}
+
+}  // namespace detail
+
+namespace detail {
+
+// Builds an eager program, returning the value an instruction computes
+// instead of emitting it again when that value already exists. A variable
+// loaded after an assignment to it is a new value, assignments are never
+// shared. Every random builtin is a value of its own, drawn from the next
+// stream.
+template <class F>
+class Builder {
+    struct Key {
+        Op op;
+        std::uint32_t a, b, c;
+        F value;
+
+        auto operator==(const Key& other) const -> bool {
+            return op == other.op and a == other.a and b == other.b and
+                   c == other.c and value == other.value and
+                   std::signbit(value) == std::signbit(other.value);
+        }
+    };
+
+    struct KeyHash {
+        auto operator()(const Key& key) const -> std::size_t {
+            auto hash = std::hash<F>{}(key.value);
+            for (const auto part :
+                 {static_cast<std::uint32_t>(key.op), key.a, key.b, key.c}) {
+                hash = hash * 31 + part;
+            }
+            return hash;
+        }
+    };
+
+   public:
+    auto emit(Instruction<F> instruction) -> std::uint32_t {
+        if (instruction.op == Op::Store) {
+            ++_versions[instruction.a];
+            return detail::emit(_program, instruction);
+        }
+        if (is_random(instruction.op)) {
+            instruction.c = _streams++;
+            return detail::emit(_program, instruction);
+        }
+
+        Key key{instruction.op, instruction.a, instruction.b, instruction.c,
+                instruction.value};
+        if (instruction.op == Op::Load) {
+            key.b = _versions[instruction.a];
+        }
+
+        const auto [found, inserted] = _values.try_emplace(
+            key, static_cast<std::uint32_t>(_program.code.size()));
+        if (inserted) {
+            detail::emit(_program, instruction);
+        }
+        return found->second;
+    }
+
+    auto slot(std::string_view name) -> std::uint32_t {
+        const auto slot = detail::slot(_program, name);
+        _versions.resize(_program.names.size());
+        return slot;
+    }
+
+    auto program() -> Program<F>& { return _program; }
+
+   private:
+    Program<F> _program;
+    std::unordered_map<Key, std::uint32_t, KeyHash> _values;
+    std::vector<std::uint32_t> _versions;
+    std::uint32_t _streams = 0;
+};
+
+// Appends the expression to the program being built, returns the index of
+// its value.
+template <class F, class It>
+auto build(Builder<F>& builder, It begin, It end)
+    -> std::optional<std::uint32_t> {
+    const auto queue = parse(begin, end);
+
+    if (not queue) {
+        return std::nullopt;
+    }
+
+    std::vector<std::uint32_t> stack;
+
+    for (auto&& token : *queue) {
+        if (token.type == Token<It>::Number) {
+            stack.push_back(
+                builder.emit({Op::Const, 0, 0, 0, parse_num<F>(token)}));
+            continue;
+        }
+
+        const str_view<It> name{token.lexeme_start, token.lexeme_end};
+
+        if (token.type == Token<It>::Assign) {
+            ASSERT(stack.size() >= 2, "Empty assignment value");
+
+            const auto value = stack.back();
+            stack.pop_back();
+            const auto target = builder.program().code[stack.back()];
+            stack.pop_back();
+
+            ASSERT(target.op == Op::Load, "Invalid assignment target");
+
+            stack.push_back(builder.emit({Op::Store, target.a, value}));
+        } else if (const auto constant = calc::detail::constant<F>(name)) {
+            stack.push_back(builder.emit({Op::Const, 0, 0, 0, *constant}));
+        } else if (name == "rand") {
+            stack.push_back(builder.emit({Op::Rand}));
+        } else if (name == "normal") {
+            ASSERT(stack.size() >= 2,
+                   "Invalid call to `" << name << "` function");
+
+            const auto sigma = stack.back();
+            stack.pop_back();
+            stack.back() = builder.emit({Op::Normal, stack.back(), sigma});
+        } else if (const auto op = unary_op(name)) {
+            ASSERT(stack.size() >= 1,
+                   "Invalid call to `" << name << "` function");
+
+            stack.back() = builder.emit({*op, stack.back()});
+        } else if (const auto op = binary_op<It>(token.type, name)) {
+            ASSERT(stack.size() >= 2,
+                   "Invalid call to `" << name << "` function");
+
+            const auto rhs = stack.back();
+            stack.pop_back();
+            stack.back() = builder.emit({*op, stack.back(), rhs});
+        } else if (const auto op = ternary_op(name)) {
+            ASSERT(stack.size() >= 3,
+                   "Invalid call to `" << name << "` function");
+
+            const auto otherwise = stack.back();
+            stack.pop_back();
+            const auto then = stack.back();
+            stack.pop_back();
+            stack.back() = builder.emit({*op, stack.back(), then, otherwise});
+        } else {
+            stack.push_back(builder.emit({Op::Load, builder.slot(name)}));
+        }
+    }
+
+    ASSERT(not stack.empty(), "Empty statement");
+    ASSERT(stack.size() == 1, "Redundant values");
+
+    return stack.back();
+}
+
+}  // namespace detail
+
+// Resolves every builtin, constant and variable of the expression once, so
+// that the result can be evaluated many times without touching the source.
+// Repeated subexpressions are computed once.
+template <class F, class It>
+auto compile(It begin, It end) -> std::optional<Program<F>> {
+    detail::Builder<F> builder;
+    const auto result = detail::build<F>(builder, begin, end);
+
+    if (not result) {
+        return std::nullopt;
+    }
+
+    builder.program().result = *result;
+
+    return detail::Lowering(builder.program())();
+}
+
+// Residual program of `program` with the variables `bindings` defines fixed
+// to their current values. Everything that depends only on fixed variables
+// and constants is computed here, the rest is left to be evaluated.
+template <class F>
+auto specialize(const Program<F>& program,
+                variables_handle<F, const char*> auto& bindings)
+    -> Program<F> {
+    const auto eager = detail::fold(
+        detail::strip(program),
+        [&bindings](std::string_view name) { return bindings.get(name); });
+
+    return detail::Lowering(eager)();
+}
+
+template <class F>
+auto specialize(const Program<F>& program,
+                std::initializer_list<std::pair<std::string_view, F>> bindings)
+    -> Program<F> {
+    Variables<F, const char*> variables;
+    for (auto&& [name, value] : bindings) {
+        variables.set(name, value);
+    }
+    return specialize(program, variables);
+}
+
+// Evaluates the program with variable values taken from `slots`, which
+// receives the values of the assignments the program performs. Operands of
+// `and`, `or` and `if` that do not affect the result are not evaluated.
+// Random builtins draw the numbers of `sample`.
+template <class F>
+auto run(const Program<F>& program, std::span<F> slots, std::vector<F>& values,
+         Sample sample) -> F {
+    return detail::interpret(program, slots, values, [](std::uint32_t, F) {},
+                             sample);
+}
+
+template <class F>
+auto run(const Program<F>& program, std::span<F> slots,
+         std::vector<F>& values) -> F {
+    return run(program, slots, values, detail::next_sample());
+}
+
+template <class F>
+auto run(const Program<F>& program, std::span<F> slots) -> F {
+    std::vector<F> values;
+    return run(program, slots, values);
+}
+
+// Reads the variables the program loads before assigning them, in slot
+// order. Slots the program assigns first are left at 0.
+template <class F>
+auto bind(const Program<F>& program,
+          variables_handle<F, const char*> auto& vars)
+    -> std::optional<std::vector<F>> {
+    std::vector<F> slots(program.names.size());
+    std::vector<std::string_view> undefined;
+    const auto needed = detail::inputs(program);
+
+    for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+        if (not needed[slot]) {
+            continue;
+        }
+        const auto& name = program.names[slot];
+        if (const auto value = vars.get(name)) {
+            slots[slot] = *value;
+        } else {
+            undefined.push_back(name);
+        }
+    }
+
+    ASSERT(undefined.empty(),
+           "Undefined variables " << detail::make_delimited_print(undefined));
+
+    return slots;
+}
+
+template <class F>
+auto evaluate(const Program<F>& program,
+              variables_handle<F, const char*> auto& vars) -> std::optional<F> {
+    auto slots = bind(program, vars);
+
+    if (not slots) {
+        return std::nullopt;
+    }
+
+    std::vector<F> values;
+
+    return detail::interpret(program, std::span(*slots), values,
+                             [&](std::uint32_t slot, F value) {
+                                 vars.set(program.names[slot], value);
+                             },
+                             detail::next_sample());
+}
+
+}  // namespace calc
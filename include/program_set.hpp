@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+
+namespace calc {
+
+// Expressions compiled into one program. Subexpressions they have in common
+// are computed once and every variable is loaded once per evaluation.
+// `outputs[i]` is the index of the value of the i-th expression, the
+// expressions are evaluated in order so later ones see earlier assignments.
+template <class F>
+struct ProgramSet {
+    Program<F> program;
+    std::vector<std::uint32_t> outputs;
+};
+
+template <class F>
+auto compile_set(std::span<const std::string_view> expressions)
+    -> std::optional<ProgramSet<F>> {
+    ASSERT(not expressions.empty(), "Empty program set");
+
+    detail::Builder<F> builder;
+    std::vector<std::uint32_t> roots;
+
+    for (auto&& expression : expressions) {
+        const auto root = detail::build<F>(
+            builder, expression.data(), expression.data() + expression.size());
+
+        if (not root) {
+            return std::nullopt;
+        }
+        roots.push_back(*root);
+    }
+
+    detail::Lowering lowering(builder.program());
+    ProgramSet<F> set;
+
+    for (const auto root : roots) {
+        set.outputs.push_back(lowering.add(root));
+    }
+
+    set.program = lowering.release();
+    set.program.result = set.outputs.back();
+
+    return set;
+}
+
+// Evaluates every expression of the set in one pass, writing the result of
+// the i-th one to `out[i]`.
+template <class F>
+auto run(const ProgramSet<F>& set, std::span<F> slots, std::vector<F>& values,
+         std::span<F> out) -> void {
+    run(set.program, slots, values);
+
+    for (std::size_t i = 0; i < set.outputs.size(); ++i) {
+        out[i] = values[set.outputs[i]];
+    }
+}
+
+template <class F>
+auto evaluate(const ProgramSet<F>& set,
+              variables_handle<F, const char*> auto& vars, std::span<F> out)
+    -> std::optional<bool> {
+    ASSERT(out.size() >= set.outputs.size(),
+           "Expected room for " << set.outputs.size() << " results");
+
+    auto slots = bind(set.program, vars);
+
+    if (not slots) {
+        return std::nullopt;
+    }
+
+    std::vector<F> values;
+    detail::interpret(set.program, std::span(*slots), values,
+                      [&](std::uint32_t slot, F value) {
+                          vars.set(set.program.names[slot], value);
+                      },
+                      detail::next_sample());
+
+    for (std::size_t i = 0; i < set.outputs.size(); ++i) {
+        out[i] = values[set.outputs[i]];
+    }
+
+    return true;
+}
+
+}  // namespace calc
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "prelude.hpp"
+
+namespace calc {
+
+// Position in the random streams of an evaluation. Every random builtin of
+// a program draws from a stream of its own, and the number it draws depends
+// only on the seed, the sample index and the stream. Samples can be split
+// across threads in any way and still reproduce the same numbers.
+struct Sample {
+    std::uint64_t seed = 0;
+    std::uint64_t index = 0;
+};
+
+namespace detail {
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"), a bijection of the counter keyed by the key.
+constexpr auto philox(std::array<std::uint32_t, 4> counter,
+                      std::array<std::uint32_t, 2> key)
+    -> std::array<std::uint32_t, 4> {
+    constexpr std::uint64_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+    constexpr std::uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+
+    for (int round = 0; round < 10; ++round) {
+        const auto p0 = m0 * counter[0];
+        const auto p1 = m1 * counter[2];
+
+        counter = {static_cast<std::uint32_t>(p1 >> 32) ^ counter[1] ^ key[0],
+                   static_cast<std::uint32_t>(p1),
+                   static_cast<std::uint32_t>(p0 >> 32) ^ counter[3] ^ key[1],
+                   static_cast<std::uint32_t>(p0)};
+        key[0] += w0;
+        key[1] += w1;
+    }
+
+    return counter;
+}
+
+// Two independent uniform doubles in [0, 1) for the sample and stream.
+constexpr auto uniform_pair(Sample sample, std::uint32_t stream)
+    -> std::array<double, 2> {
+    const auto bits = philox(
+        {static_cast<std::uint32_t>(sample.index),
+         static_cast<std::uint32_t>(sample.index >> 32), stream, 0},
+        {static_cast<std::uint32_t>(sample.seed),
+         static_cast<std::uint32_t>(sample.seed >> 32)});
+
+    const auto high = (std::uint64_t{bits[0]} << 32 | bits[1]) >> 11;
+    const auto low = (std::uint64_t{bits[2]} << 32 | bits[3]) >> 11;
+
+    return {static_cast<double>(high) * 0x1p-53,
+            static_cast<double>(low) * 0x1p-53};
+}
+
+// Sample used by evaluations that are not given one: every call moves the
+// calling thread to the next sample.
+inline auto next_sample() -> Sample {
+    thread_local std::uint64_t index = 0;
+    return {0, index++};
+}
+
+}  // namespace detail
+
+// Uniform number in [0, 1).
+template <class F>
+auto uniform(Sample sample, std::uint32_t stream) -> F {
+    return static_cast<F>(detail::uniform_pair(sample, stream)[0]);
+}
+
+// Normally distributed number by the Box-Muller transform.
+template <class F>
+auto normal(Sample sample, std::uint32_t stream, F mu, F sigma) -> F {
+    const auto [u, v] = detail::uniform_pair(sample, stream);
+    const auto radius = std::sqrt(-2 * std::log(1 - u));
+
+    return mu + sigma * static_cast<F>(radius * std::cos(TAU * v));
+}
+
+}  // namespace calc
@@ -0,0 +1,526 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "concurrent_variables.hpp"
+#include "prelude.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+
+namespace calc {
+
+struct ServerLimits {
+    // longest accepted expression, in bytes
+    std::size_t max_request_size = 64 * 1024;
+    // time a request may take from its first byte to its evaluation
+    std::chrono::milliseconds request_timeout{1000};
+    std::size_t max_connections = 1024;
+    std::size_t max_cached_programs = 4096;
+};
+
+struct ServerStats {
+    std::uint64_t connections = 0;
+    std::uint64_t requests = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t timeouts = 0;
+    std::uint64_t batches = 0;
+    std::uint64_t compilations = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::chrono::nanoseconds total_latency{0};
+    std::chrono::nanoseconds max_latency{0};
+};
+
+inline auto& operator<<(std::ostream& os, const ServerStats& stats) {
+    const auto answered = std::max<std::uint64_t>(stats.requests, 1);
+    return os << "connections=" << stats.connections
+              << " requests=" << stats.requests
+              << " errors=" << stats.errors
+              << " timeouts=" << stats.timeouts
+              << " batches=" << stats.batches
+              << " compilations=" << stats.compilations
+              << " bytes_in=" << stats.bytes_in
+              << " bytes_out=" << stats.bytes_out << " mean_latency_us="
+              << stats.total_latency.count() / answered / 1000
+              << " max_latency_us=" << stats.max_latency.count() / 1000;
+}
+
+// Evaluation daemon listening on a Unix domain socket.
+//
+// A request is either a line of text terminated by '\n', or `$<size>\n`
+// followed by `size` bytes of expression. Every request is answered with one
+// line, `= <result>` or `! <reason>`, in the order the requests arrived on
+// the connection. The `:stats` request answers with the counters.
+//
+// Requests that arrive during one wakeup of the event loop are evaluated as
+// one batch. Compiled programs are cached by source text and shared by all
+// connections, as are the variables assigned by the requests. A batch sees
+// its own assignments at once, they are published to `variables()` when it
+// ends, and other threads may read them there without blocking the loop.
+template <class F>
+class Server {
+    using clock = std::chrono::steady_clock;
+    using shared_variables = ConcurrentVariables<F, const char*>;
+
+    struct Connection {
+        std::string input, output;
+        std::optional<clock::time_point> started;
+        bool closing = false;
+        bool writing = false;
+        // the peer is gone, nothing more can be sent
+        bool broken = false;
+    };
+
+    // A request, or with `error` set the rejection of what the connection
+    // sent after the requests before it.
+    struct Request {
+        int fd;
+        std::string expression;
+        clock::time_point started;
+        std::string_view error = {};
+    };
+
+    // A cached expression, run on the VM when it fits.
+    struct Compiled {
+        std::optional<Program<F>> program;
+        std::optional<VmProgram<F>> vm;
+    };
+
+   public:
+    explicit Server(std::string path, ServerLimits limits = {})
+        : _path(std::move(path)), _limits(limits) {}
+
+    Server(const Server&) = delete;
+    auto operator=(const Server&) -> Server& = delete;
+
+    ~Server() {
+        for (auto&& [fd, connection] : _connections) {
+            ::close(fd);
+        }
+        if (_listener >= 0) {
+            ::close(_listener);
+            ::unlink(_path.c_str());
+        }
+        if (_epoll >= 0) {
+            ::close(_epoll);
+        }
+    }
+
+    // Serves until `stop` is set, returns the process exit code.
+    auto run(const std::atomic<bool>& stop) -> int {
+        if (not listen()) {
+            return 1;
+        }
+
+        std::array<epoll_event, 64> events;
+
+        while (not stop) {
+            const auto ready = ::epoll_wait(
+                _epoll, events.data(), static_cast<int>(events.size()), 100);
+
+            if (ready < 0 and errno != EINTR) {
+                std::cerr << "epoll_wait: " << std::strerror(errno) << '\n';
+                return 1;
+            }
+
+            for (int i = 0; i < ready; ++i) {
+                const auto fd = events[i].data.fd;
+
+                if (fd == _listener) {
+                    accept();
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive(fd);
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    hang_up(fd);
+                }
+            }
+
+            evaluate_batch();
+            expire();
+            flush();
+        }
+
+        return 0;
+    }
+
+    auto stats() const -> const ServerStats& { return _stats; }
+
+    auto variables() -> shared_variables& { return _variables; }
+
+   private:
+    auto listen() -> bool {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (_path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path is too long: " << _path << '\n';
+            return false;
+        }
+        std::ranges::copy(_path, address.sun_path);
+
+        _listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        ::unlink(_path.c_str());
+
+        if (_listener < 0 or
+            ::bind(_listener, reinterpret_cast<sockaddr*>(&address),
+                   sizeof(address)) < 0 or
+            ::listen(_listener, SOMAXCONN) < 0) {
+            std::cerr << "Cannot listen on " << _path << ": "
+                      << std::strerror(errno) << '\n';
+            return false;
+        }
+
+        _epoll = ::epoll_create1(0);
+        watch(_listener);
+
+        return true;
+    }
+
+    auto watch(int fd, int operation = EPOLL_CTL_ADD,
+               std::uint32_t events = EPOLLIN) -> void {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        ::epoll_ctl(_epoll, operation, fd, &event);
+    }
+
+    auto accept() -> void {
+        for (;;) {
+            const auto fd = ::accept4(_listener, nullptr, nullptr,
+                                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            if (_connections.size() >= _limits.max_connections) {
+                ::close(fd);
+                continue;
+            }
+
+            ++_stats.connections;
+            _connections[fd];
+            watch(fd);
+        }
+    }
+
+    auto receive(int fd) -> void {
+        const auto found = _connections.find(fd);
+        if (found == _connections.end()) {
+            return;
+        }
+
+        auto& connection = found->second;
+        std::array<char, 4096> buffer;
+
+        for (;;) {
+            const auto size = ::read(fd, buffer.data(), buffer.size());
+
+            if (size == 0 or (size < 0 and errno != EAGAIN and
+                              errno != EWOULDBLOCK and errno != EINTR)) {
+                connection.closing = true;
+                break;
+            }
+            if (size < 0) {
+                break;
+            }
+
+            _stats.bytes_in += static_cast<std::uint64_t>(size);
+            if (connection.input.empty()) {
+                connection.started = clock::now();
+            }
+            connection.input.append(buffer.data(),
+                                    static_cast<std::size_t>(size));
+
+            split(fd, connection);
+
+            if (connection.input.size() > _limits.max_request_size + 32) {
+                reject_after_batch(fd, connection, "request too large");
+            }
+            if (connection.closing) {
+                break;
+            }
+        }
+    }
+
+    // Moves every complete request of the connection into the batch.
+    auto split(int fd, Connection& connection) -> void {
+        std::string_view input = connection.input;
+
+        while (not input.empty()) {
+            std::string_view expression;
+
+            const auto line = input.find('\n');
+            if (line == std::string_view::npos) {
+                break;
+            }
+
+            if (input.front() == '$') {
+                std::size_t size = 0;
+                const auto [end, error] =
+                    std::from_chars(input.data() + 1, input.data() + line, size);
+
+                if (error != std::errc{} or end != input.data() + line or
+                    size > _limits.max_request_size) {
+                    reject_after_batch(fd, connection,
+                                       "malformed or oversized request");
+                    return;
+                }
+                if (input.size() - line - 1 < size) {
+                    break;
+                }
+
+                expression = input.substr(line + 1, size);
+                input.remove_prefix(line + 1 + size);
+            } else {
+                if (line > _limits.max_request_size) {
+                    reject_after_batch(fd, connection, "request too large");
+                    return;
+                }
+
+                expression = input.substr(0, line);
+                input.remove_prefix(line + 1);
+
+                if (expression.ends_with('\r')) {
+                    expression.remove_suffix(1);
+                }
+            }
+
+            if (not expression.empty()) {
+                _batch.push_back({fd, std::string(expression),
+                                  connection.started.value_or(clock::now())});
+            }
+        }
+
+        if (input.size() == connection.input.size()) {
+            return;
+        }
+
+        connection.input.erase(0, connection.input.size() - input.size());
+        connection.started.reset();
+        if (not connection.input.empty()) {
+            connection.started = clock::now();
+        }
+    }
+
+    auto evaluate_batch() -> void {
+        if (_batch.empty()) {
+            return;
+        }
+
+        ++_stats.batches;
+
+        {
+            auto variables = _variables.snapshot();
+            for (auto&& request : _batch) {
+                answer(request, variables);
+            }
+        }
+
+        _batch.clear();
+        _variables.publish();
+    }
+
+    auto answer(const Request& request,
+                typename shared_variables::Snapshot& variables) -> void {
+        const auto found = _connections.find(request.fd);
+        if (found == _connections.end()) {
+            return;
+        }
+        auto& output = found->second.output;
+
+        if (not request.error.empty()) {
+            ++_stats.errors;
+            output += "! ";
+            output += request.error;
+            output += '\n';
+            return;
+        }
+
+        ++_stats.requests;
+
+        if (clock::now() - request.started > _limits.request_timeout) {
+            ++_stats.timeouts;
+            ++_stats.errors;
+            output += "! timeout\n";
+            return;
+        }
+
+        if (request.expression == ":stats") {
+            std::ostringstream line;
+            line << "= " << _stats << '\n';
+            output += line.str();
+            return;
+        }
+
+        const auto result = evaluate(request.expression, variables);
+
+        if (result) {
+            std::array<char, 64> number;
+            const auto end =
+                std::to_chars(number.data(), number.data() + number.size(),
+                              *result)
+                    .ptr;
+            output += "= ";
+            output.append(number.data(), end);
+            output += '\n';
+        } else {
+            ++_stats.errors;
+            output += "! invalid expression\n";
+        }
+
+        const auto latency = clock::now() - request.started;
+        _stats.total_latency += latency;
+        _stats.max_latency =
+            std::max<std::chrono::nanoseconds>(_stats.max_latency, latency);
+    }
+
+    auto evaluate(const std::string& expression,
+                  typename shared_variables::Snapshot& variables)
+        -> std::optional<F> {
+        auto cached = _programs.find(expression);
+
+        if (cached == _programs.end()) {
+            if (_programs.size() >= _limits.max_cached_programs) {
+                _programs.clear();
+            }
+            ++_stats.compilations;
+            auto program = calc::compile<F>(
+                expression.data(), expression.data() + expression.size());
+            auto vm = program ? calc::assemble(*program) : std::nullopt;
+            cached = _programs
+                         .emplace(expression,
+                                  Compiled{std::move(program), std::move(vm)})
+                         .first;
+        }
+
+        const auto& [program, vm] = cached->second;
+
+        if (not program) {
+            return std::nullopt;
+        }
+
+        return calc::evaluate(*program, vm, variables);
+    }
+
+    // Answers requests left incomplete for longer than the timeout.
+    auto expire() -> void {
+        const auto now = clock::now();
+
+        for (auto&& [fd, connection] : _connections) {
+            if (connection.started and
+                now - *connection.started > _limits.request_timeout) {
+                ++_stats.timeouts;
+                reject(connection, "timeout");
+            }
+        }
+    }
+
+    auto reject(Connection& connection, std::string_view reason) -> void {
+        ++_stats.errors;
+        connection.output += "! ";
+        connection.output += reason;
+        connection.output += '\n';
+        connection.input.clear();
+        connection.started.reset();
+        connection.closing = true;
+    }
+
+    // Like `reject`, answered after the requests of the connection already
+    // in the batch. `reason` must outlive the batch.
+    auto reject_after_batch(int fd, Connection& connection,
+                            std::string_view reason) -> void {
+        _batch.push_back({fd, {}, clock::now(), reason});
+        connection.input.clear();
+        connection.started.reset();
+        connection.closing = true;
+    }
+
+    auto hang_up(int fd) -> void {
+        if (const auto found = _connections.find(fd);
+            found != _connections.end()) {
+            found->second.broken = true;
+        }
+    }
+
+    auto flush() -> void {
+        for (auto it = _connections.begin(); it != _connections.end();) {
+            auto& [fd, connection] = *it;
+
+            while (not connection.broken and not connection.output.empty()) {
+                const auto size =
+                    ::send(fd, connection.output.data(),
+                           connection.output.size(), MSG_NOSIGNAL);
+                if (size < 0 and errno == EINTR) {
+                    continue;
+                }
+                if (size < 0 and errno != EAGAIN and errno != EWOULDBLOCK) {
+                    connection.broken = true;
+                }
+                if (size <= 0) {
+                    break;
+                }
+                _stats.bytes_out += static_cast<std::uint64_t>(size);
+                connection.output.erase(0, static_cast<std::size_t>(size));
+            }
+
+            // requests read before the hang up were still evaluated, their
+            // answers have nowhere to go
+            if (connection.broken or
+                (connection.closing and connection.output.empty())) {
+                ::close(fd);
+                it = _connections.erase(it);
+                continue;
+            }
+
+            // wait for the socket to drain instead of retrying every tick
+            const auto writing = not connection.output.empty();
+            if (writing != connection.writing) {
+                connection.writing = writing;
+                watch(fd, EPOLL_CTL_MOD,
+                      writing ? EPOLLIN | EPOLLOUT : EPOLLIN);
+            }
+            ++it;
+        }
+    }
+
+    std::string _path;
+    ServerLimits _limits;
+    ServerStats _stats;
+
+    int _listener = -1;
+    int _epoll = -1;
+
+    std::unordered_map<int, Connection> _connections;
+    std::vector<Request> _batch;
+    std::unordered_map<std::string, Compiled> _programs;
+    shared_variables _variables;
+};
+
+}  // namespace calc
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <iterator>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
 
@@ -9,6 +10,38 @@
 
 namespace calc {
 
+namespace detail {
+
+template <class F, class C>
+constexpr auto constant(std::basic_string_view<C> name) -> std::optional<F> {
+    if (name == "e") {
+        return calc::E;
+    } else if (name == "e_gamma") {
+        return calc::E_GAMMA;
+    } else if (name == "tau") {
+        return calc::TAU;
+    } else if (name == "phi") {
+        return calc::PHI;
+    } else if (name == "quarter_pi") {
+        return calc::QUARTER_PI;
+    } else if (name == "half_pi") {
+        return calc::HALF_PI;
+    } else if (name == "pi") {
+        return calc::PI;
+    } else if (name == "two_pi") {
+        return calc::TWO_PI;
+    } else if (name == "inv_pi") {
+        return calc::INV_PI;
+    } else if (name == "inv_sqrt_pi") {
+        return calc::INV_SQRT_PI;
+    } else if (name == "inv_two_pi") {
+        return calc::INV_TWO_PI;
+    }
+    return std::nullopt;
+}
+
+}  // namespace detail
+
 template <class F, class It>
 class Variables {
     using value_type = std::iter_value_t<It>;
@@ -17,33 +50,12 @@ class Variables {
 
    public:
     auto get(str_view name) -> std::optional<F> const {
-        if (name == "e") {
-            return calc::E;
-        } else if (name == "e_gamma") {
-            return calc::E_GAMMA;
-        } else if (name == "tau") {
-            return calc::TAU;
-        } else if (name == "phi") {
-            return calc::PHI;
-        } else if (name == "quarter_pi") {
-            return calc::QUARTER_PI;
-        } else if (name == "half_pi") {
-            return calc::HALF_PI;
-        } else if (name == "pi") {
-            return calc::PI;
-        } else if (name == "two_pi") {
-            return calc::TWO_PI;
-        } else if (name == "inv_pi") {
-            return calc::INV_PI;
-        } else if (name == "inv_sqrt_pi") {
-            return calc::INV_SQRT_PI;
-        } else if (name == "inv_two_pi") {
-            return calc::INV_TWO_PI;
-        } else {
-            const auto result = _registry.find(str(name));
-            if (result != _registry.end()) {
-                return result->second;
-            }
+        if (const auto constant = detail::constant<F>(name)) {
+            return constant;
+        }
+        const auto result = _registry.find(str(name));
+        if (result != _registry.end()) {
+            return result->second;
         }
         return std::nullopt;
     }
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "prelude.hpp"
+#include "program.hpp"
+#include "random.hpp"
+
+// Labels as values let every handler jump straight to the next one instead
+// of returning to a shared switch. Defining CALC_VM_NO_COMPUTED_GOTO keeps
+// the switch.
+#if defined(__GNUC__) and not defined(CALC_VM_NO_COMPUTED_GOTO)
+#define CALC_VM_COMPUTED_GOTO 1
+#endif
+
+// Builtins the VM runs under the same name as in `Op`.
+#define CALC_VM_UNARY(X) \
+    X(Sqrt)              \
+    X(Cbrt)              \
+    X(Abs)               \
+    X(Ln)                \
+    X(Lg)                \
+    X(Exp)               \
+    X(Ceil)              \
+    X(Floor)             \
+    X(Round)             \
+    X(Trunc)             \
+    X(Sin)               \
+    X(Asin)              \
+    X(Sinh)              \
+    X(Asinh)             \
+    X(Cos)               \
+    X(Acos)              \
+    X(Cosh)              \
+    X(Acosh)             \
+    X(Tan)               \
+    X(Atan)              \
+    X(Tanh)              \
+    X(Atanh)
+
+#define CALC_VM_BINARY(X) \
+    X(Add)                \
+    X(Sub)                \
+    X(Mul)                \
+    X(Div)                \
+    X(Mod)                \
+    X(Pow)                \
+    X(LessThan)           \
+    X(LessEquals)         \
+    X(GreaterThan)        \
+    X(GreaterEquals)      \
+    X(Equals)             \
+    X(Min)                \
+    X(Max)                \
+    X(Log)                \
+    X(Gcd)                \
+    X(Lcm)                \
+    X(And)                \
+    X(Or)                 \
+    X(Xor)
+
+#define CALC_VM_OTHER(X) \
+    X(Select)            \
+    X(Fma)               \
+    X(Rand)              \
+    X(Normal)            \
+    X(MulAdd)            \
+    X(Move)              \
+    X(Jump)              \
+    X(JumpIf)            \
+    X(JumpUnless)        \
+    X(Return)
+
+namespace calc {
+
+// Size of the register file of the VM. The variables, the constants and the
+// intermediate values live at the same time of a program have to fit.
+constexpr std::size_t vm_registers = 256;
+
+#define CALC_VM_ENUMERATOR(name) name,
+
+// Operations of the VM. Besides the builtins there are `MulAdd`, the
+// multiplication and the addition of `a * b + c` rounded separately, `Move`,
+// the jumps and `Return`.
+enum class VmOp : std::uint8_t {
+    CALC_VM_UNARY(CALC_VM_ENUMERATOR) CALC_VM_BINARY(CALC_VM_ENUMERATOR)
+        CALC_VM_OTHER(CALC_VM_ENUMERATOR)
+};
+
+#undef CALC_VM_ENUMERATOR
+
+// Register instruction: `dst` receives the result of the values in registers
+// `a`, `b` and `c`. Jumps continue at instruction `target`, random builtins
+// draw from stream `target`.
+struct VmInstruction {
+    VmOp op;
+    std::uint8_t dst = 0, a = 0, b = 0, c = 0;
+    std::uint16_t target = 0;
+};
+
+// Program of the VM. Registers start with the variables in slot order,
+// followed by `constants`; the rest holds intermediate values.
+template <class F>
+struct VmProgram {
+    std::vector<VmInstruction> code;
+    std::vector<F> constants;
+    std::vector<std::string> names;
+};
+
+namespace detail {
+
+constexpr auto vm_op(Op op) -> VmOp {
+#define CALC_VM_CONVERSION(name) \
+    case Op::name:               \
+        return VmOp::name;
+
+    switch (op) {
+        CALC_VM_UNARY(CALC_VM_CONVERSION)
+        CALC_VM_BINARY(CALC_VM_CONVERSION)
+        case Op::Select:
+            return VmOp::Select;
+        case Op::Fma:
+            return VmOp::Fma;
+        case Op::Rand:
+            return VmOp::Rand;
+        case Op::Normal:
+            return VmOp::Normal;
+        case Op::Jump:
+            return VmOp::Jump;
+        case Op::JumpIf:
+            return VmOp::JumpIf;
+        case Op::JumpUnless:
+            return VmOp::JumpUnless;
+        default:
+            return VmOp::Move;
+    }
+
+#undef CALC_VM_CONVERSION
+}
+
+// Assigns a register to every value of a lowered program. Variables that are
+// never assigned and constants are read from their own registers, so their
+// loads disappear. Intermediate values get a register from the first free
+// ones, which is released after their last use. Jumps only go forward, so
+// every path runs the instructions in program order and a register freed
+// after its last use in that order is never read again.
+//
+// A multiplication used only by the next addition that is executed becomes
+// one `MulAdd` with it.
+template <class F>
+class Assembler {
+    static constexpr auto none = UINT32_MAX;
+
+   public:
+    explicit Assembler(const Program<F>& program)
+        : _program(program),
+          _same(program.code.size()),
+          _last(program.code.size()),
+          _fused(program.code.size()),
+          _register(program.code.size(), none) {}
+
+    auto operator()() -> std::optional<VmProgram<F>> {
+        const auto& code = _program.code;
+        const auto size = code.size();
+
+        ASSERT(size < UINT16_MAX,
+               "Expression is too long for the VM: " << size
+                                                     << " instructions");
+        // random builtins keep their stream in the 16 bits of `target`
+        ASSERT(std::ranges::none_of(code,
+                                    [](auto&& instruction) {
+                                        return is_random(instruction.op) and
+                                               instruction.c > UINT16_MAX;
+                                    }),
+               "Expression has too many random builtins for the VM");
+
+        std::vector<bool> assigned(_program.names.size());
+        std::vector<std::uint32_t> uses(size);
+
+        for (std::size_t i = 0; i < size; ++i) {
+            const auto& instruction = code[i];
+
+            _same[i] = instruction.op == Op::Store
+                           ? _same[instruction.b]
+                           : static_cast<std::uint32_t>(i);
+            if (instruction.op == Op::Store) {
+                assigned[instruction.a] = true;
+            }
+            for_each_operand(instruction,
+                             [&](std::uint32_t operand) { ++uses[operand]; });
+        }
+
+        _vm.names = _program.names;
+        _next = static_cast<std::uint32_t>(_program.names.size());
+
+        for (std::size_t i = 0; i < size; ++i) {
+            const auto& instruction = code[i];
+            if (instruction.op == Op::Const) {
+                _register[i] = _next++;
+                _vm.constants.push_back(instruction.value);
+            } else if (instruction.op == Op::Load and
+                       not assigned[instruction.a]) {
+                _register[i] = instruction.a;
+            }
+        }
+        _first_temporary = _next;
+        _used = _next;
+
+        for (std::size_t i = 0; i < size; ++i) {
+            auto next = i + 1;
+            while (next < size and _register[next] != none) {
+                ++next;
+            }
+            _fused[i] = code[i].op == Op::Mul and uses[i] == 1 and
+                        next < size and code[next].op == Op::Add and
+                        (code[next].a == i or code[next].b == i);
+        }
+
+        for (std::size_t i = 0; i < size; ++i) {
+            operands(i, [&](std::uint32_t operand) {
+                _last[_same[operand]] = static_cast<std::uint32_t>(i);
+            });
+        }
+        _last[_same[_program.result]] = static_cast<std::uint32_t>(size);
+
+        std::vector<std::uint32_t> position(size + 1);
+        std::vector<std::size_t> jumps;
+
+        for (std::size_t i = 0; i < size; ++i) {
+            position[i] = static_cast<std::uint32_t>(_vm.code.size());
+
+            if (_register[i] != none or _fused[i]) {
+                continue;
+            }
+
+            if (is_jump(code[i].op)) {
+                jumps.push_back(_vm.code.size());
+            }
+            emit(i);
+        }
+
+        position[size] = static_cast<std::uint32_t>(_vm.code.size());
+        _vm.code.push_back(
+            {VmOp::Return, 0, reg(_program.result), 0, 0, 0});
+
+        for (const auto jump : jumps) {
+            auto& instruction = _vm.code[jump];
+            instruction.target =
+                static_cast<std::uint16_t>(position[instruction.target]);
+        }
+
+        ASSERT(_used <= vm_registers, "Expression needs "
+                                          << _used << " registers, the VM has "
+                                          << vm_registers);
+
+        return std::move(_vm);
+    }
+
+   private:
+    // Calls `fn` with every value instruction `i` reads, the operands of a
+    // multiplication fused into it included.
+    template <class Fn>
+    auto operands(std::size_t i, Fn fn) const -> void {
+        for_each_operand(_program.code[i], [&](std::uint32_t operand) {
+            if (_fused[operand]) {
+                for_each_operand(_program.code[operand], fn);
+            } else {
+                fn(operand);
+            }
+        });
+    }
+
+    auto emit(std::size_t i) -> void {
+        const auto& instruction = _program.code[i];
+        VmInstruction vm{vm_op(instruction.op)};
+
+        switch (instruction.op) {
+            case Op::Load:
+                vm.a = static_cast<std::uint8_t>(instruction.a);
+                break;
+            case Op::Store:
+                vm.dst = static_cast<std::uint8_t>(instruction.a);
+                vm.a = reg(instruction.b);
+                break;
+            case Op::Jump:
+                vm.target = static_cast<std::uint16_t>(instruction.b);
+                break;
+            case Op::JumpIf:
+            case Op::JumpUnless:
+                vm.a = reg(instruction.a);
+                vm.target = static_cast<std::uint16_t>(instruction.b);
+                break;
+            case Op::Add:
+                if (const auto product = _fused[instruction.a]   ? instruction.a
+                                         : _fused[instruction.b] ? instruction.b
+                                                                 : none;
+                    product != none) {
+                    const auto& mul = _program.code[product];
+                    vm = {VmOp::MulAdd, 0, reg(mul.a), reg(mul.b),
+                          reg(product == instruction.a ? instruction.b
+                                                       : instruction.a)};
+                    break;
+                }
+                [[fallthrough]];
+            default:
+                vm.a = reg(instruction.a);
+                vm.b = reg(instruction.b);
+                vm.c = reg(instruction.c);
+                if (is_random(instruction.op)) {
+                    vm.target = static_cast<std::uint16_t>(instruction.c);
+                }
+                break;
+        }
+
+        // operands read here for the last time hand their registers over
+        operands(i, [&](std::uint32_t operand) {
+            const auto value = _same[operand];
+            if (_last[value] == i and _register[value] >= _first_temporary and
+                std::ranges::find(_free, _register[value]) == _free.end()) {
+                _free.push_back(_register[value]);
+            }
+        });
+
+        if (instruction.op != Op::Store and not is_jump(instruction.op)) {
+            vm.dst = allocate(i);
+        }
+        _vm.code.push_back(vm);
+    }
+
+    auto allocate(std::size_t i) -> std::uint8_t {
+        if (_free.empty()) {
+            _free.push_back(_next++);
+        }
+        std::ranges::sort(_free, std::greater{});
+        _register[i] = _free.back();
+        _free.pop_back();
+        _used = std::max<std::size_t>(_used, _next);
+
+        if (_last[i] == 0) {
+            _free.push_back(_register[i]);
+        }
+        return static_cast<std::uint8_t>(_register[i]);
+    }
+
+    auto reg(std::uint32_t value) const -> std::uint8_t {
+        return static_cast<std::uint8_t>(_register[_same[value]]);
+    }
+
+    const Program<F>& _program;
+    VmProgram<F> _vm;
+    std::vector<std::uint32_t> _same;
+    std::vector<std::uint32_t> _last;
+    std::vector<bool> _fused;
+    std::vector<std::uint32_t> _register;
+    std::vector<std::uint32_t> _free;
+    std::uint32_t _next = 0;
+    std::uint32_t _first_temporary = 0;
+    std::size_t _used = 0;
+};
+
+}  // namespace detail
+
+// Translates a compiled program for the VM.
+template <class F>
+auto assemble(const Program<F>& program) -> std::optional<VmProgram<F>> {
+    return detail::Assembler(program)();
+}
+
+// Evaluates the program like `run` does for a `Program`, with its values in
+// a fixed register file.
+template <class F>
+auto run(const VmProgram<F>& vm, std::span<F> slots, Sample sample) -> F {
+    std::array<F, vm_registers> r;
+    const auto variables = vm.names.size();
+
+    std::copy_n(slots.begin(), variables, r.begin());
+    std::ranges::copy(vm.constants, r.begin() + variables);
+
+    const auto* const code = vm.code.data();
+    const auto* ip = code;
+
+#ifdef CALC_VM_COMPUTED_GOTO
+#define CALC_VM_LABEL(name) &&vm_##name,
+    static const void* const labels[] = {CALC_VM_UNARY(CALC_VM_LABEL)
+                                             CALC_VM_BINARY(CALC_VM_LABEL)
+                                                 CALC_VM_OTHER(CALC_VM_LABEL)};
+#undef CALC_VM_LABEL
+#define CALC_VM_CASE(name) vm_##name
+#define CALC_VM_DISPATCH() goto* labels[static_cast<std::size_t>(ip->op)]
+
+    CALC_VM_DISPATCH();
+#else
+#define CALC_VM_CASE(name) case VmOp::name
+#define CALC_VM_DISPATCH() continue
+
+    for (;;) {
+        switch (ip->op) {
+#endif
+
+#define CALC_VM_NEXT() \
+    ++ip;              \
+    CALC_VM_DISPATCH()
+#define CALC_VM_UNARY_CASE(name)                                     \
+    CALC_VM_CASE(name) : r[ip->dst] = detail::apply(Op::name, r[ip->a]); \
+    CALC_VM_NEXT();
+#define CALC_VM_BINARY_CASE(name)                                           \
+    CALC_VM_CASE(name) : r[ip->dst] =                                        \
+        detail::apply(Op::name, r[ip->a], r[ip->b]);                         \
+    CALC_VM_NEXT();
+
+            CALC_VM_UNARY(CALC_VM_UNARY_CASE)
+            CALC_VM_BINARY(CALC_VM_BINARY_CASE)
+
+            CALC_VM_CASE(Select) : r[ip->dst] =
+                detail::select(r[ip->a], r[ip->b], r[ip->c]);
+            CALC_VM_NEXT();
+            CALC_VM_CASE(Fma) : r[ip->dst] =
+                std::fma(r[ip->a], r[ip->b], r[ip->c]);
+            CALC_VM_NEXT();
+            CALC_VM_CASE(Rand) : r[ip->dst] = uniform<F>(sample, ip->target);
+            CALC_VM_NEXT();
+            CALC_VM_CASE(Normal) : r[ip->dst] =
+                normal(sample, ip->target, r[ip->a], r[ip->b]);
+            CALC_VM_NEXT();
+            CALC_VM_CASE(MulAdd) : r[ip->dst] = r[ip->a] * r[ip->b] + r[ip->c];
+            CALC_VM_NEXT();
+            CALC_VM_CASE(Move) : r[ip->dst] = r[ip->a];
+            CALC_VM_NEXT();
+            CALC_VM_CASE(Jump) : ip = code + ip->target;
+            CALC_VM_DISPATCH();
+            CALC_VM_CASE(JumpIf) : ip = detail::truthy(r[ip->a])
+                                            ? code + ip->target
+                                            : ip + 1;
+            CALC_VM_DISPATCH();
+            CALC_VM_CASE(JumpUnless) : ip = detail::truthy(r[ip->a])
+                                                ? ip + 1
+                                                : code + ip->target;
+            CALC_VM_DISPATCH();
+            CALC_VM_CASE(Return) : std::copy_n(r.begin(), variables,
+                                               slots.begin());
+            return r[ip->a];
+
+#undef CALC_VM_BINARY_CASE
+#undef CALC_VM_UNARY_CASE
+#undef CALC_VM_NEXT
+#undef CALC_VM_DISPATCH
+#undef CALC_VM_CASE
+
+#ifndef CALC_VM_COMPUTED_GOTO
+        }
+    }
+#endif
+}
+
+template <class F>
+auto run(const VmProgram<F>& vm, std::span<F> slots) -> F {
+    return run(vm, slots, detail::next_sample());
+}
+
+// Evaluates the program like `evaluate` does, on the VM when `vm` holds its
+// translation. Programs with an assignment a jump can skip are interpreted,
+// so that only the assignments that run are published.
+template <class F>
+auto evaluate(const Program<F>& program, const std::optional<VmProgram<F>>& vm,
+              variables_handle<F, const char*> auto& vars) -> std::optional<F> {
+    const auto stored = detail::stored(program);
+
+    if (not vm or not stored) {
+        return evaluate(program, vars);
+    }
+
+    auto slots = bind(program, vars);
+
+    if (not slots) {
+        return std::nullopt;
+    }
+
+    const auto result = run(*vm, std::span(*slots));
+
+    for (std::size_t slot = 0; slot < slots->size(); ++slot) {
+        if ((*stored)[slot]) {
+            vars.set(program.names[slot], (*slots)[slot]);
+        }
+    }
+
+    return result;
+}
+
+}  // namespace calc
+
+#undef CALC_VM_COMPUTED_GOTO
+#undef CALC_VM_OTHER
+#undef CALC_VM_BINARY
+#undef CALC_VM_UNARY
@@ -1,11 +1,28 @@
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <ostream>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include "codegen.hpp"
+#include "columns.hpp"
 #include "evaluator.hpp"
+#include "fast_math.hpp"
+#include "monte_carlo.hpp"
+#include "pipeline.hpp"
 #include "prelude.hpp"
+#include "program.hpp"
+#include "server.hpp"
 #include "variables.hpp"
+#include "vm.hpp"
 
 template <class F>
 auto get_styled(F num) {
@@ -63,6 +80,229 @@ auto repl() -> int {
     return 1;
 }
 
+auto stream() -> int {
+    using F = double;
+
+    calc::Variables<F, const char*> variables;
+    int code = 0;
+
+    for (auto&& result : calc::stream<F>(std::cin, variables)) {
+        if (result) {
+            std::cout << get_styled(*result) << '\n';
+        } else {
+            std::cout << "error\n";
+            code = 1;
+        }
+    }
+
+    return code;
+}
+
+// Times `iterations` evaluations of the expression by the token evaluator,
+// the program interpreter and the VM, with every variable set to 1.5.
+auto bench(std::string_view expression, std::size_t iterations) -> int {
+    using F = double;
+    using Clock = std::chrono::steady_clock;
+
+    const auto begin = expression.data(), end = begin + expression.size();
+    const auto queue = calc::parse(begin, end);
+    const auto program = calc::compile<F>(begin, end);
+    const auto vm = program ? calc::assemble(*program) : std::nullopt;
+
+    if (not queue or not vm) {
+        return 1;
+    }
+
+    calc::Variables<F, const char*> variables;
+    std::vector<F> slots(program->names.size(), 1.5), values;
+
+    for (auto&& name : program->names) {
+        variables.set(name, 1.5);
+    }
+
+    F sum = 0;
+    const auto time = [&](std::string_view name, std::size_t instructions,
+                          auto evaluate) {
+        const auto start = Clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            sum += evaluate();
+        }
+        const std::chrono::duration<double, std::nano> elapsed =
+            Clock::now() - start;
+        const auto per_evaluation = elapsed.count() / iterations;
+
+        std::cout << std::setw(8) << name << std::setw(6) << instructions
+                  << " instructions " << std::fixed << std::setprecision(1)
+                  << std::setw(10) << per_evaluation << " ns/evaluation "
+                  << std::setw(8) << per_evaluation / instructions
+                  << " ns/instruction\n";
+    };
+
+    time("tokens", queue->size(),
+         [&]() { return *calc::execute<F>(*queue, variables); });
+    time("program", program->code.size(), [&]() {
+        return calc::run(*program, std::span(slots), values);
+    });
+    time("vm", vm->code.size(),
+         [&]() { return calc::run(*vm, std::span(slots)); });
+
+    // keeps the evaluations from being optimized away
+    std::cerr << "checksum " << sum << '\n';
+
+    return 0;
+}
+
+// Compiles the expression, applying the rewrites of `calc::fast_math` and
+// printing which fired to the standard error when `fast` is set.
+auto compile(std::string_view expression, bool fast)
+    -> std::optional<calc::Program<double>> {
+    auto program = calc::compile<double>(
+        expression.data(), expression.data() + expression.size());
+
+    if (program and fast) {
+        calc::FastMathReport report;
+        program = calc::fast_math(*program, report);
+        std::cerr << report << '\n';
+    }
+
+    return program;
+}
+
+auto fast_math(std::string_view expression) -> int {
+    using F = double;
+
+    const auto program = compile(expression, true);
+
+    if (not program) {
+        return 1;
+    }
+
+    calc::Variables<F, const char*> variables;
+    const auto result = calc::evaluate(*program, variables);
+
+    if (not result) {
+        return 1;
+    }
+
+    std::cout << get_styled(*result) << std::flush;
+
+    return 0;
+}
+
+auto emit_cpp(std::string_view name, std::string_view expression, bool fast)
+    -> int {
+    const auto program = compile(expression, fast);
+
+    if (not program or not calc::emit_cpp(std::cout, *program, name)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Evaluates the expression for `samples` samples of its random builtins and
+// prints the distribution of the results.
+auto monte_carlo(std::string_view expression, std::size_t samples,
+                 std::size_t jobs, std::uint64_t seed, calc::MathMode mode)
+    -> int {
+    const auto program = compile(expression, mode == calc::MathMode::Fast);
+
+    if (not program) {
+        return 1;
+    }
+
+    const auto summary =
+        calc::monte_carlo(*program, samples, jobs, seed, mode);
+
+    if (not summary) {
+        return 1;
+    }
+
+    std::cout << std::setprecision(15) << *summary << std::flush;
+
+    return 0;
+}
+
+#ifdef __linux__
+// Evaluates the expression for every row of the input files, printing the
+// results or writing them to a binary column file.
+auto columns(std::string_view expression,
+             const std::vector<std::string>& inputs, const char* output,
+             std::uint64_t seed, calc::MathMode mode) -> int {
+    using F = double;
+
+    const auto program = compile(expression, mode == calc::MathMode::Fast);
+
+    if (not program) {
+        return 1;
+    }
+
+    std::ofstream file;
+    if (output) {
+        file.open(output, std::ios::binary);
+        if (not file) {
+            std::cerr << "Cannot write " << output << '\n';
+            return 1;
+        }
+    }
+
+    std::string text;
+    const auto sink = [&](std::span<const F> results) {
+        if (output) {
+            return static_cast<bool>(
+                file.write(reinterpret_cast<const char*>(results.data()),
+                           static_cast<std::streamsize>(results.size_bytes())));
+        }
+
+        text.clear();
+        for (const auto result : results) {
+            char number[64];
+            text.append(number,
+                        std::to_chars(number, number + sizeof(number), result)
+                            .ptr);
+            text.push_back('\n');
+        }
+        return static_cast<bool>(std::cout.write(
+            text.data(), static_cast<std::streamsize>(text.size())));
+    };
+
+    std::optional<std::size_t> rows;
+
+    if (inputs.size() == 1 and inputs.front().ends_with(".csv")) {
+        auto source = calc::CsvColumns<F>::open(inputs.front());
+        rows = source ? calc::run_columns(*program, *source, sink,
+                                          64 * calc::batch_block, mode,
+                                          calc::Sample{seed, 0})
+                      : std::nullopt;
+    } else {
+        auto source = calc::BinaryColumns<F>::open(inputs);
+        rows = source ? calc::run_columns(*program, *source, sink,
+                                          64 * calc::batch_block, mode,
+                                          calc::Sample{seed, 0})
+                      : std::nullopt;
+    }
+
+    return rows ? 0 : 1;
+}
+
+std::atomic<bool> stop_serving = false;
+
+auto serve(const char* path) -> int {
+    using F = double;
+
+    const auto stop = [](int) { stop_serving = true; };
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+
+    calc::Server<F> server(path);
+    const auto code = server.run(stop_serving);
+
+    std::cerr << server.stats() << std::endl;
+
+    return code;
+}
+#endif
+
 int main(int argc, char* argv[]) {
     using F = double;
 
@@ -72,6 +312,129 @@ int main(int argc, char* argv[]) {
         return repl();
     }
 
+    if (std::string_view(argv[1]) == "--stream") {
+        return stream();
+    }
+
+    // `--fast-math` in front of column input, sampling or C++ export
+    // rewrites the expression with `calc::fast_math`, and evaluates it with
+    // the kernels of `MathMode::Fast`
+    auto mode = calc::MathMode::Exact;
+    if (argc > 3 and std::string_view(argv[1]) == "--fast-math") {
+        mode = calc::MathMode::Fast;
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+
+        const std::string_view next = argv[1];
+        if (next.starts_with("--") and next != "--emit-cpp" and
+            next != "--samples") {
+            std::cerr << "--fast-math applies to an expression, --input,"
+                         " --samples and --emit-cpp\n";
+            return 1;
+        }
+    }
+    const auto fast = mode == calc::MathMode::Fast;
+
+    if (std::string_view(argv[1]) == "--fast-math") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " --fast-math <expression>\n";
+            return 1;
+        }
+        return fast_math(argv[2]);
+    }
+
+    if (std::string_view(argv[1]) == "--emit-cpp") {
+        if (argc < 4) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--fast-math] --emit-cpp <name> <expression>\n";
+            return 1;
+        }
+        return emit_cpp(argv[2], argv[3], fast);
+    }
+
+    if (std::string_view(argv[1]) == "--bench") {
+        std::size_t iterations = 1'000'000;
+        const auto parsed = [&]() {
+            const auto end = argv[3] + std::strlen(argv[3]);
+            return std::from_chars(argv[3], end, iterations).ptr == end;
+        };
+        if (argc < 3 or (argc > 3 and not parsed())) {
+            std::cerr << "Usage: " << argv[0]
+                      << " --bench <expression> [iterations]\n";
+            return 1;
+        }
+        return bench(argv[2], iterations);
+    }
+
+    if (std::string_view(argv[1]) == "--samples") {
+        std::uint64_t samples = 0, seed = 0;
+        std::uint64_t jobs = std::thread::hardware_concurrency();
+        bool valid = argc % 2 == 0;
+
+        for (int i = 1; valid and i + 2 < argc; i += 2) {
+            const std::string_view option = argv[i], value = argv[i + 1];
+            auto* number = option == "--samples" ? &samples
+                           : option == "--jobs"  ? &jobs
+                           : option == "--seed"  ? &seed
+                                                 : nullptr;
+            valid = number and
+                    std::from_chars(value.data(), value.data() + value.size(),
+                                    *number)
+                            .ptr == value.data() + value.size();
+        }
+
+        if (not valid or samples == 0) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--fast-math] --samples <n> [--jobs <m>]"
+                         " [--seed <s>] <expression>\n";
+            return 1;
+        }
+        return monte_carlo(argv[argc - 1], samples, jobs, seed, mode);
+    }
+
+#ifdef __linux__
+    if (std::string_view(argv[1]) == "--serve") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " --serve <socket>\n";
+            return 1;
+        }
+        return serve(argv[2]);
+    }
+#endif
+
+#ifdef __linux__
+    if (argc > 2) {
+        std::vector<std::string> inputs;
+        const char* output = nullptr;
+        std::uint64_t seed = 0;
+
+        for (int i = 2; i + 1 < argc; i += 2) {
+            const std::string_view option = argv[i], value = argv[i + 1];
+            if (option == "--input") {
+                inputs.emplace_back(value);
+            } else if (option == "--output") {
+                output = argv[i + 1];
+            } else if (option != "--seed" or
+                       std::from_chars(value.data(),
+                                       value.data() + value.size(), seed)
+                               .ptr != value.data() + value.size()) {
+                inputs.clear();
+                break;
+            }
+        }
+
+        if (inputs.empty() or argc % 2 != 0) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--fast-math] <expression>"
+                         " --input <file.csv | column file>..."
+                         " [--output <column file>] [--seed <s>]\n";
+            return 1;
+        }
+        return columns(argv[1], inputs, output, seed, mode);
+    }
+#endif
+
     const std::basic_string_view expr = argv[1];
 
     const auto result = calc::evaluate<F>(expr.begin(), expr.end(), variables);
@@ -0,0 +1,212 @@
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "batch.hpp"
+#include "check.hpp"
+#include "program.hpp"
+#include "random.hpp"
+
+// Batch mode must give, row for row, what the scalar interpreter gives.
+constexpr std::size_t rows = 3 * calc::batch_block + 17;
+
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+// Distance in representable doubles, with -0 and +0 next to each other.
+auto ulps(double a, double b) -> double {
+    const auto order = [](double x) {
+        const auto bits = std::bit_cast<std::int64_t>(x);
+        return bits < 0 ? INT64_MIN - bits : bits;
+    };
+    const auto x = order(a), y = order(b);
+    return static_cast<double>(x > y ? static_cast<std::uint64_t>(x) -
+                                           static_cast<std::uint64_t>(y)
+                                     : static_cast<std::uint64_t>(y) -
+                                           static_cast<std::uint64_t>(x));
+}
+
+auto compile(std::string_view expression) {
+    return calc::compile<double>(expression.data(),
+                                 expression.data() + expression.size());
+}
+
+auto compare(std::string_view expression,
+             const std::vector<std::vector<double>>& data) -> void {
+    const auto program = compile(expression);
+    CHECK(program.has_value(), expression << " does not compile");
+    if (not program) {
+        return;
+    }
+
+    // x, y and z have a column each, other variables have none
+    std::vector<const double*> columns(program->names.size());
+    for (std::size_t slot = 0; slot < columns.size(); ++slot) {
+        const auto column = program->names[slot][0] - 'x';
+        if (column >= 0 and column < 3) {
+            columns[slot] = data[static_cast<std::size_t>(column)].data();
+        }
+    }
+
+    std::vector<double> out(rows);
+    CHECK(calc::run_batch(*program, std::span<const double* const>(columns),
+                          out.data(), rows, calc::MathMode::Exact,
+                          calc::Sample{7, 100}),
+          expression << " is rejected");
+
+    std::vector<double> slots(columns.size()), values;
+    std::size_t wrong = 0;
+
+    for (std::size_t row = 0; row < rows; ++row) {
+        for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+            slots[slot] = columns[slot] ? columns[slot][row] : 0;
+        }
+        const auto expected = calc::run(*program, std::span(slots), values,
+                                        calc::Sample{7, 100 + row});
+        wrong += not same(out[row], expected);
+    }
+
+    CHECK(wrong == 0, expression << " differs in " << wrong << " rows");
+}
+
+// `MathMode::Fast` must stay within `bound(x, y)` ulp of the interpreter,
+// which adds up to half an ulp of libm to the error documented with
+// `MathMode`.
+template <class Bound>
+auto compare_fast(std::string_view expression,
+                  const std::vector<std::vector<double>>& data, Bound bound)
+    -> void {
+    const auto program = compile(expression);
+    std::vector<const double*> columns(program->names.size());
+    for (std::size_t slot = 0; slot < columns.size(); ++slot) {
+        columns[slot] = data[static_cast<std::size_t>(
+                                 program->names[slot][0] - 'x')]
+                            .data();
+    }
+
+    std::vector<double> out(rows);
+    CHECK(calc::run_batch(*program, std::span<const double* const>(columns),
+                          out.data(), rows, calc::MathMode::Fast),
+          expression << " is rejected");
+
+    std::vector<double> slots(columns.size()), values;
+    std::size_t wrong = 0;
+
+    for (std::size_t row = 0; row < rows; ++row) {
+        for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+            slots[slot] = columns[slot][row];
+        }
+        const auto expected = calc::run(*program, std::span(slots), values);
+        const auto x = data[0][row], y = data[1][row];
+        wrong += not same(out[row], expected) and
+                 not(ulps(out[row], expected) <= bound(x, y));
+    }
+
+    CHECK(wrong == 0, expression << " in fast mode is off in " << wrong
+                                 << " rows");
+}
+
+auto main() -> int {
+    std::vector<std::vector<double>> data(3, std::vector<double>(rows));
+    for (std::size_t row = 0; row < rows; ++row) {
+        const auto t = static_cast<double>(row);
+        data[0][row] = std::sin(t) * 10;
+        data[1][row] = std::cos(t * 0.7) * 3;
+        data[2][row] = 100;
+    }
+
+    for (const auto* expression : {
+             "x * y + z",
+             "sqrt(abs(x)) + exp(y / 4) - ln(z)",
+             "if(x > y, x ** 2, y / 3) + min(x, z)",
+             "and(x > 0, y < 1) + or(x, y) * 2 + xor(x, y)",
+             "pi * 2 + sin(1) * x",
+             "(z = x * 2) + z",
+             "(w = 3) * 2 + w * x",
+             "x + (x = 3) * x",
+             "(y = sin(y)) + (y = y * 2) + y",
+             "rand() + normal(x, 1) * rand()",
+         }) {
+        compare(expression, data);
+    }
+
+    // subexpressions of no variable are computed on the first block only
+    // and must still be there for the later ones
+    for (const auto* expression : {
+             "sin(2) + 3 * 4",
+             "if(2 > 1, sin(3) * x, cos(2)) + max(ln(5), exp(1)) * y",
+             "(w = sqrt(2) * 3) + w * x + lg(100)",
+             "and(pi > 3, x) + or(0, cos(1)) * if(y > 0, tanh(1), 2)",
+         }) {
+        compare(expression, data);
+    }
+
+    // fast kernels against libm, other builtins exactly
+    {
+        const auto ulp = [](double n) {
+            return [n](double, double) { return n; };
+        };
+        compare_fast("exp(y)", data, ulp(2));
+        compare_fast("ln(abs(x))", data, ulp(2));
+        compare_fast("sin(x)", data, ulp(3));
+        compare_fast("cos(x)", data, ulp(3));
+        compare_fast("tanh(y)", data, ulp(4));
+        compare_fast("abs(x) ** y", data, [](double x, double y) {
+            return 2 * (1 + std::abs(y * std::log(std::abs(x)))) + 1;
+        });
+        compare_fast("x * y + z", data, ulp(0));
+        compare_fast("sqrt(abs(x)) + floor(y) - min(x, z)", data, ulp(0));
+        compare_fast("if(x > y, x * x, y / 3) + and(x, y)", data, ulp(0));
+    }
+
+    // the assigned value wins over the column of the same name
+    {
+        const auto program = compile("(z = x * 2) + z");
+        std::vector<const double*> columns(program->names.size());
+        const double x = 1, z = 100;
+        for (std::size_t slot = 0; slot < columns.size(); ++slot) {
+            columns[slot] = program->names[slot] == "x" ? &x : &z;
+        }
+        double out = 0;
+        calc::run_batch(*program, std::span<const double* const>(columns),
+                        &out, 1);
+        CHECK(out == 4, "(z = x * 2) + z gives " << out);
+    }
+
+    // assigned variables need no column, loaded ones do
+    {
+        const auto program = compile("(w = 2) * w");
+        std::vector<const double*> columns(program->names.size());
+        double out = 0;
+        CHECK(calc::run_batch(*program,
+                              std::span<const double* const>(columns), &out,
+                              1) and
+                  out == 4,
+              "(w = 2) * w gives " << out);
+
+        const auto loads = compile("w * (w = 2)");
+        CHECK(not calc::run_batch(*loads,
+                                  std::span<const double* const>(columns),
+                                  &out, 1),
+              "missing column accepted");
+    }
+
+    // both branches run for every row, a conditional assignment cannot
+    {
+        const auto program = compile("if(x > 0, w = 1, 2) + 1");
+        std::vector<const double*> columns(program->names.size(),
+                                           data[0].data());
+        std::vector<double> out(rows);
+        CHECK(not calc::run_batch(*program,
+                                  std::span<const double* const>(columns),
+                                  out.data(), rows),
+              "conditional assignment accepted");
+    }
+
+    return check::result();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iostream>
+
+namespace check {
+
+inline int failures = 0;
+
+// Exit code of a test, `main` ends with `return check::result();`.
+inline auto result() -> int {
+    if (failures != 0) {
+        std::cerr << failures << " checks failed\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+}  // namespace check
+
+// Reports a failed check and carries on, so one run lists every failure.
+#define CHECK(condition, message)                                         \
+    do {                                                                  \
+        if (!(condition)) {                                               \
+            ++check::failures;                                            \
+            std::cerr << __FILE__ << " line " << __LINE__ << ": `"        \
+                      << #condition "` failed: " << message << std::endl; \
+        }                                                                 \
+    } while (false)
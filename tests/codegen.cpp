@@ -0,0 +1,84 @@
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "codegen.hpp"
+#include "emitted.hpp"
+#include "program.hpp"
+#include "variables.hpp"
+
+// The headers the calculator emitted at build time must give what the
+// interpreter gives for the same expression.
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+auto compile(std::string_view expression) {
+    return *calc::compile<double>(expression.data(),
+                                  expression.data() + expression.size());
+}
+
+// The slots of the emitted function, in the order `emit_cpp` lays them out.
+auto slots(const calc::Program<double>& program) -> std::vector<std::string> {
+    return calc::detail::Lowering(
+               calc::detail::fold(calc::detail::strip(program),
+                                  [](std::string_view) -> std::optional<double> {
+                                      return {};
+                                  }))()
+        .names;
+}
+
+auto compare(const Emitted& emitted, std::mt19937_64& engine) -> void {
+    const auto program = compile(emitted.expression);
+    const auto names = slots(program);
+    std::uniform_real_distribution<double> distribution(-5, 5);
+
+    for (int i = 0; i < 1000; ++i) {
+        calc::Variables<double, const char*> vars;
+        std::vector<double> values(names.size());
+        for (std::size_t slot = 0; slot < names.size(); ++slot) {
+            // integer arguments now and then for `%`, gcd and xor
+            values[slot] = i % 4 == 0 ? std::round(distribution(engine))
+                                      : distribution(engine);
+            vars.set(names[slot], values[slot]);
+        }
+
+        const auto expected = calc::evaluate(program, vars);
+        const auto result = emitted.function(values.data());
+
+        if (not expected or not same(result, *expected)) {
+            CHECK(false, emitted.expression << " gives " << result
+                                            << ", the interpreter "
+                                            << expected.value_or(NAN));
+            return;
+        }
+    }
+}
+
+auto rejects(std::string_view name) -> void {
+    std::ostringstream os;
+    CHECK(not calc::emit_cpp(os, compile("x + 1"), name),
+          '`' << name << "` accepted as a function name");
+}
+
+auto main() -> int {
+    std::mt19937_64 engine(42);
+    for (auto&& entry : emitted) {
+        compare(entry, engine);
+    }
+
+    for (const auto* name : {"int", "return", "and", "xor", "_Foo", "_x",
+                             "a__b", "std", "NAN", "FP_ZERO", "main", "1x",
+                             "x-y", ""}) {
+        rejects(name);
+    }
+
+    std::ostringstream os;
+    CHECK(calc::emit_cpp(os, compile("x + 1"), "integral_x"),
+          "integral_x rejected");
+
+    return check::result();
+}
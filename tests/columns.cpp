@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "columns.hpp"
+#include "program.hpp"
+
+// `run_columns` must bind variables by name, chunk after chunk, and only
+// ask for columns the program reads before it assigns them.
+constexpr std::size_t rows = 1000;
+
+// Columns held in memory, handed out `rows` at a time.
+class Table {
+   public:
+    Table(std::vector<std::string> names, std::vector<std::vector<double>> data)
+        : _names(std::move(names)), _data(std::move(data)) {}
+
+    auto names() const -> const std::vector<std::string>& { return _names; }
+
+    auto next(std::size_t count) -> std::optional<std::size_t> {
+        _row += _count;
+        _count = std::min(count, _data.front().size() - _row);
+        return _count;
+    }
+
+    auto column(std::size_t i) const -> const double* {
+        return _data[i].data() + _row;
+    }
+
+   private:
+    std::vector<std::string> _names;
+    std::vector<std::vector<double>> _data;
+    std::size_t _row = 0;
+    std::size_t _count = 0;
+};
+
+auto table() -> Table {
+    std::vector<std::vector<double>> data(2, std::vector<double>(rows));
+    for (std::size_t row = 0; row < rows; ++row) {
+        data[0][row] = static_cast<double>(row);
+        data[1][row] = static_cast<double>(row % 7);
+    }
+    return Table({"x", "y"}, std::move(data));
+}
+
+auto compile(std::string_view expression) {
+    return *calc::compile<double>(expression.data(),
+                                  expression.data() + expression.size());
+}
+
+// Runs `expression` over the table, by default in chunks of 64 rows.
+auto collect(std::string_view expression, std::size_t chunk = 64,
+             calc::Sample first = {}) -> std::optional<std::vector<double>> {
+    auto source = table();
+    std::vector<double> out;
+    const auto count = calc::run_columns(
+        compile(expression), source,
+        [&out](std::span<const double> results) {
+            out.insert(out.end(), results.begin(), results.end());
+            return true;
+        },
+        chunk, calc::MathMode::Exact, first);
+
+    if (not count) {
+        return std::nullopt;
+    }
+    CHECK(*count == rows and out.size() == rows,
+          expression << " gives " << out.size() << " rows");
+    return out;
+}
+
+// Files for the CSV and binary readers, removed with the directory.
+class Files {
+   public:
+    Files()
+        : _directory(std::filesystem::temp_directory_path() /
+                     ("calculator-columns-" + std::to_string(::getpid()))) {
+        std::filesystem::create_directories(_directory);
+    }
+
+    Files(const Files&) = delete;
+    auto operator=(const Files&) -> Files& = delete;
+
+    ~Files() { std::filesystem::remove_all(_directory); }
+
+    auto write(const std::string& name, std::string_view content)
+        -> std::string {
+        const auto path = (_directory / name).string();
+        std::ofstream(path, std::ios::binary)
+            .write(content.data(),
+                   static_cast<std::streamsize>(content.size()));
+        return path;
+    }
+
+    auto write(const std::string& name, const std::vector<double>& values)
+        -> std::string {
+        return write(name, std::string_view(
+                               reinterpret_cast<const char*>(values.data()),
+                               values.size() * sizeof(double)));
+    }
+
+   private:
+    std::filesystem::path _directory;
+};
+
+// Runs `expression` over `source` in chunks of two rows.
+template <class Source>
+auto run(std::string_view expression, Source& source)
+    -> std::optional<std::vector<double>> {
+    std::vector<double> out;
+    const auto count = calc::run_columns(
+        compile(expression), source,
+        [&out](std::span<const double> results) {
+            out.insert(out.end(), results.begin(), results.end());
+            return true;
+        },
+        2);
+
+    if (not count) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+auto csv(Files& files) -> void {
+    // names and values are trimmed, blank lines and carriage returns skipped
+    {
+        auto source = calc::CsvColumns<double>::open(files.write(
+            "good.csv", " x ,\ty\r\n1, 2\r\n\n  3 ,\t4 \r\n5,6\n\n"));
+        CHECK(source, "good.csv is rejected");
+        if (source) {
+            CHECK(source->names() == std::vector<std::string>({"x", "y"}),
+                  "header of good.csv misread");
+            const auto out = run("x * 10 + y", *source);
+            CHECK(out == std::vector<double>({12, 34, 56}),
+                  "rows of good.csv misread");
+        }
+    }
+
+    const auto rejects = [&files](std::string_view content,
+                                  std::string_view expression) {
+        auto source =
+            calc::CsvColumns<double>::open(files.write("bad.csv", content));
+        return not source or not run(expression, *source);
+    };
+
+    CHECK(rejects("x,y\n1,2\n3,abc\n", "x + y"), "malformed value accepted");
+    CHECK(rejects("x,y\n1,2\n3 4,5\n", "x + y"),
+          "value with a space accepted");
+    CHECK(rejects("x,y\n1,2\n3\n", "x + y"), "short row accepted");
+    CHECK(rejects("x,y\n1,2,3\n", "x + y"), "long row accepted");
+    CHECK(rejects("x,y\n1,2\n", "x + w"), "missing column accepted");
+    CHECK(rejects("", "x"), "file without header accepted");
+    CHECK(not calc::CsvColumns<double>::open("/nonexistent/columns.csv"),
+          "missing file accepted");
+}
+
+auto binary(Files& files) -> void {
+    std::vector<double> x(rows), y(rows);
+    for (std::size_t row = 0; row < rows; ++row) {
+        x[row] = static_cast<double>(row);
+        y[row] = static_cast<double>(row % 7);
+    }
+
+    // variables are named after the files and read chunk by chunk
+    {
+        const std::string paths[] = {files.write("x.f64", x),
+                                     files.write("y.values.f64", y)};
+        auto source = calc::BinaryColumns<double>::open(paths);
+        CHECK(source, "binary columns rejected");
+        if (source) {
+            CHECK(source->names() == std::vector<std::string>({"x", "y"}),
+                  "binary column names misread");
+            const auto out = run("x * 2 + y", *source);
+            bool right = out and out->size() == rows;
+            for (std::size_t row = 0; right and row < rows; ++row) {
+                right = out->at(row) == x[row] * 2 + y[row];
+            }
+            CHECK(right, "binary columns misread");
+        }
+    }
+
+    {
+        y.pop_back();
+        const std::string paths[] = {files.write("x.f64", x),
+                                     files.write("y.f64", y)};
+        CHECK(not calc::BinaryColumns<double>::open(paths),
+              "columns of different lengths accepted");
+    }
+
+    {
+        const std::string paths[] = {files.write("x.f64", "1234567")};
+        CHECK(not calc::BinaryColumns<double>::open(paths),
+              "partial value accepted");
+    }
+
+    {
+        const std::string paths[] = {files.write("x.f64", x)};
+        auto source = calc::BinaryColumns<double>::open(paths);
+        CHECK(source and not run("x + y", *source), "missing column accepted");
+    }
+}
+
+auto main() -> int {
+    {
+        Files files;
+        csv(files);
+        binary(files);
+    }
+
+    {
+        const auto out = collect("x * 2 + y");
+        CHECK(out, "x * 2 + y is rejected");
+        for (std::size_t row = 0; out and row < rows; ++row) {
+            CHECK(out->at(row) == static_cast<double>(row * 2 + row % 7),
+                  "x * 2 + y at row " << row << " gives " << out->at(row));
+        }
+    }
+
+    // z is assigned before it is read and needs no column
+    {
+        const auto out = collect("(z = x * 2) + z");
+        CHECK(out, "(z = x * 2) + z is rejected");
+        for (std::size_t row = 0; out and row < rows; ++row) {
+            CHECK(out->at(row) == static_cast<double>(row * 4),
+                  "(z = x * 2) + z at row " << row << " gives "
+                                            << out->at(row));
+        }
+    }
+
+    // a column of the same name is overwritten by the assignment
+    {
+        const auto out = collect("(y = x) + y");
+        CHECK(out and out->back() == 2 * (rows - 1),
+              "(y = x) + y ignores the assignment");
+    }
+
+    CHECK(not collect("z * (z = 2)"), "z read before assignment accepted");
+    CHECK(not collect("x + w"), "missing column accepted");
+
+    // every row draws a sample of its own, whatever the chunk size
+    {
+        const auto out = collect("rand() + x * 0");
+        auto sorted = out.value_or(std::vector<double>{});
+        std::ranges::sort(sorted);
+        CHECK(out and std::ranges::adjacent_find(sorted) == sorted.end(),
+              "rand() repeats across rows");
+
+        CHECK(collect("rand() + x * 0", rows) == out,
+              "rand() depends on the chunk size");
+        CHECK(collect("rand() + x * 0", 64, calc::Sample{5, 0}) != out,
+              "seed 5 gives the numbers of seed 0");
+        CHECK(collect("rand() + x * 0", 64, calc::Sample{0, 1})->front() ==
+                  out->at(1),
+              "the first sample does not move the rows");
+    }
+
+    return check::result();
+}
@@ -0,0 +1,117 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "concurrent_variables.hpp"
+
+// Readers hammer the store while a writer publishes `a` and `b` together:
+// every snapshot must see them equal and never older than the last one seen.
+template <std::size_t readers>
+auto stress(std::size_t threads, std::size_t publishes) -> void {
+    calc::ConcurrentVariables<double, const char*, readers> vars;
+    vars.set("a", 0).set("b", 0).publish();
+
+    std::atomic<bool> done = false;
+    std::atomic<std::size_t> ready = 0, torn = 0, stale = 0, reads = 0;
+
+    const auto read = [&]() {
+        double last = 0;
+        std::size_t count = 0;
+        ++ready;
+
+        while (not done) {
+            auto snapshot = vars.snapshot();
+            const auto a = snapshot.get("a").value_or(-1);
+            const auto b = snapshot.get("b").value_or(-1);
+
+            torn += a != b;
+            stale += a < last;
+            last = a;
+
+            stale += vars.get("a").value_or(-1) < last;
+            ++count;
+        }
+        reads += count;
+    };
+
+    {
+        std::vector<std::jthread> pool;
+        for (std::size_t i = 0; i < threads; ++i) {
+            pool.emplace_back(read);
+        }
+        // publish only once every reader runs, or some may never read
+        while (ready < threads) {
+            std::this_thread::yield();
+        }
+
+        for (std::size_t i = 1; i <= publishes; ++i) {
+            vars.set("a", static_cast<double>(i));
+            vars.set("b", static_cast<double>(i));
+            vars.publish();
+        }
+        done = true;
+    }
+
+    CHECK(torn == 0, torn << " snapshots saw half a publish");
+    CHECK(stale == 0, stale << " reads went back in time");
+    CHECK(reads > 0, "no reader ran");
+    CHECK(vars.get("a") == static_cast<double>(publishes),
+          "last publish lost");
+}
+
+// Reader latency should not grow with the number of readers as long as they
+// have a core each, every one announces itself in a cache line of its own.
+// Only reported, timing is too noisy on shared machines to fail on.
+auto latency(std::size_t threads) -> void {
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t gets = 100'000;
+
+    calc::ConcurrentVariables<double, const char*> vars;
+    vars.set("x", 1).publish();
+
+    std::atomic<std::size_t> ready = 0;
+    std::atomic<long> total = 0;
+
+    {
+        std::vector<std::jthread> pool;
+        for (std::size_t i = 0; i < threads; ++i) {
+            pool.emplace_back([&]() {
+                ++ready;
+                while (ready < threads) {
+                    std::this_thread::yield();
+                }
+
+                double sum = 0;
+                const auto start = clock::now();
+                for (std::size_t j = 0; j < gets; ++j) {
+                    sum += vars.get("x").value_or(0);
+                }
+                total += (clock::now() - start).count();
+
+                CHECK(sum == gets, "wrong value read");
+            });
+        }
+    }
+
+    std::cout << threads << " readers: "
+              << static_cast<double>(total) / static_cast<double>(threads) /
+                     gets
+              << " ns per get\n";
+}
+
+auto main() -> int {
+    stress<64>(8, 5'000);
+
+    // more readers than slots, the extra ones must not wait for a slot
+    stress<2>(8, 5'000);
+
+    for (std::size_t threads = 1; threads <= 8; threads *= 2) {
+        latency(threads);
+    }
+
+    return check::result();
+}
@@ -0,0 +1,13 @@
+# writes the header `calculator --emit-cpp` gives for one expression, called
+# with -D calculator=... -D name=... -D expression=... -D output=...
+
+execute_process(
+    COMMAND ${calculator} --emit-cpp ${name} ${expression}
+    OUTPUT_FILE ${output}
+    RESULT_VARIABLE result
+)
+
+if (NOT result EQUAL 0)
+    file(REMOVE ${output})
+    message(FATAL_ERROR "cannot emit ${name}: ${expression}")
+endif ()
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <random>
+#include <string>
+
+namespace check {
+
+// Random expressions over x, y, z and w for differential tests. `w` is also
+// assigned now and then, `random` allows rand() and normal().
+inline auto expression(std::mt19937_64& engine, int depth, bool random = true)
+    -> std::string {
+    const auto pick = [&engine](int n) {
+        return std::uniform_int_distribution<int>(0, n - 1)(engine);
+    };
+    const auto sub = [&] { return expression(engine, depth - 1, random); };
+
+    if (depth == 0 or pick(4) == 0) {
+        switch (pick(random ? 7 : 6)) {
+            case 0:
+                return "x";
+            case 1:
+                return "y";
+            case 2:
+                return "z";
+            case 3:
+                return "w";
+            case 4:
+                return std::to_string(pick(7));
+            case 5:
+                return std::to_string(pick(100) / 8.0);
+            default:
+                return "rand()";
+        }
+    }
+
+    static constexpr const char* binary[] = {"+", "-", "*", "/", "**",
+                                             "%", ">", "<", "=="};
+    static constexpr const char* unary[] = {"sqrt",  "abs",  "ln",
+                                            "exp",   "sin",  "cos",
+                                            "tanh",  "floor", "asin"};
+    static constexpr const char* pair[] = {"min", "max", "and", "or", "xor"};
+
+    switch (pick(random ? 7 : 6)) {
+        case 0:
+        case 1:
+            return '(' + sub() + ' ' + binary[pick(9)] + ' ' + sub() + ')';
+        case 2:
+            return std::string(unary[pick(9)]) + '(' + sub() + ')';
+        case 3:
+            return std::string(pair[pick(5)]) + '(' + sub() + ", " + sub() +
+                   ')';
+        case 4:
+            return "if(" + sub() + ", " + sub() + ", " + sub() + ')';
+        case 5:
+            return "(w = " + sub() + ')';
+        default:
+            return "normal(" + sub() + ", " + sub() + ')';
+    }
+}
+
+}  // namespace check
@@ -0,0 +1,159 @@
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "fast_math.hpp"
+#include "program.hpp"
+
+// Evaluates every rewrite of `fast_math` against the strict program over
+// random arguments and checks the deviation documented with it.
+constexpr std::size_t samples = 100'000;
+
+// Distance in representable doubles, with -0 and +0 next to each other.
+auto ulps(double a, double b) -> double {
+    const auto order = [](double x) {
+        const auto bits = std::bit_cast<std::int64_t>(x);
+        return bits < 0 ? INT64_MIN - bits : bits;
+    };
+    const auto x = order(a), y = order(b);
+    return static_cast<double>(x > y ? static_cast<std::uint64_t>(x) -
+                                           static_cast<std::uint64_t>(y)
+                                     : static_cast<std::uint64_t>(y) -
+                                           static_cast<std::uint64_t>(x));
+}
+
+auto ulp(double x) -> double {
+    return std::nextafter(std::abs(x), HUGE_VAL) - std::abs(x);
+}
+
+auto compile(std::string_view expression) {
+    return *calc::compile<double>(expression.data(),
+                                  expression.data() + expression.size());
+}
+
+// Binds x and y by name, the rewrites may reorder the slots.
+auto run(const calc::Program<double>& program, double x, double y)
+    -> double {
+    std::vector<double> slots(program.names.size());
+    for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+        slots[slot] = program.names[slot] == "x" ? x : y;
+    }
+    return calc::run(program, std::span(slots));
+}
+
+using Counter = std::size_t calc::FastMathReport::*;
+using Distribution = std::function<double(std::mt19937_64&)>;
+
+// `within(x, y, strict, fast)` tells whether the fast result is close enough.
+template <class Within>
+auto differ(std::string_view expression, Counter rewrite, Distribution x,
+            Distribution y, Within within) -> void {
+    const auto strict = compile(expression);
+    calc::FastMathReport report;
+    const auto fast = calc::fast_math(strict, report);
+
+    CHECK(report.*rewrite == 1, expression << " is not rewritten");
+
+    std::mt19937_64 engine(42);
+    std::size_t wrong = 0;
+
+    for (std::size_t i = 0; i < samples; ++i) {
+        const auto a = x(engine), b = y(engine);
+        const auto expected = run(strict, a, b);
+        const auto result = run(fast, a, b);
+
+        if (not within(a, b, expected, result) and wrong++ == 0) {
+            CHECK(false, expression << " at x = " << a << ", y = " << b
+                                    << " gives " << result << ", strictly "
+                                    << expected);
+        }
+    }
+    CHECK(wrong == 0, expression << " is off " << wrong << " times");
+}
+
+auto uniform(double lo, double hi) {
+    return [=](std::mt19937_64& engine) {
+        return std::uniform_real_distribution<double>(lo, hi)(engine);
+    };
+}
+
+// Every binade between 2^lo and 2^hi gets the same share.
+auto logarithmic(double lo, double hi) {
+    return [=](std::mt19937_64& engine) {
+        return std::exp2(
+            std::uniform_real_distribution<double>(lo, hi)(engine));
+    };
+}
+
+auto main() -> int {
+    using Report = calc::FastMathReport;
+
+    for (const auto n : {2, 3, 7, 16, 31, 64, -1, -3, -64}) {
+        const auto expression =
+            n > 0 ? "x ** " + std::to_string(n)
+                  : "x ** (0 - " + std::to_string(-n) + ")";
+        differ(expression, &Report::power_chains, logarithmic(-15, 15),
+               uniform(0, 0), [n](double, double, double strict, double fast) {
+                   return ulps(strict, fast) <= std::abs(n);
+               });
+    }
+
+    for (const auto* expression : {"x ** 0.5", "x ** (1 / 2)"}) {
+        differ(expression, &Report::square_roots, logarithmic(-1074, 1024),
+               uniform(0, 0), [](double, double, double strict, double fast) {
+                   return ulps(strict, fast) <= 1;
+               });
+    }
+
+    for (const auto* expression :
+         {"x / 3", "x / 10", "x / 0.1", "x / 1e300"}) {
+        differ(expression, &Report::reciprocals, uniform(-1e6, 1e6),
+               uniform(0, 0), [](double, double, double strict, double fast) {
+                   return ulps(strict, fast) <= 1;
+               });
+    }
+
+    differ("x / 1024", &Report::reciprocals, logarithmic(-1000, 1000),
+           uniform(0, 0), [](double, double, double strict, double fast) {
+               return strict == fast;
+           });
+
+    differ("exp(x) * exp(y)", &Report::exp_products, uniform(-300, 300),
+           uniform(-300, 300),
+           [](double x, double y, double strict, double fast) {
+               return ulps(strict, fast) <= std::abs(x + y) + 2;
+           });
+
+    // the product stays finite and normal
+    differ("ln(x) + ln(y)", &Report::ln_sums, logarithmic(-500, 500),
+           logarithmic(-500, 500),
+           [](double x, double y, double strict, double fast) {
+               const auto bound =
+                   2 * std::max(ulp(std::log(x)), ulp(std::log(y)));
+               return std::abs(strict - fast) <= bound;
+           });
+
+    if constexpr (calc::detail::fast_fma<double>) {
+        differ("x * y + 1", &Report::fused_multiply_adds, uniform(-10, 10),
+               uniform(-10, 10),
+               [](double x, double y, double strict, double fast) {
+                   return std::abs(strict - fast) <= ulp(x * y);
+               });
+    }
+
+    // the reciprocal of a huge divisor is subnormal and loses bits
+    {
+        calc::FastMathReport report;
+        calc::fast_math(compile("x / 1e308"), report);
+        CHECK(report.reciprocals == 0, "subnormal reciprocal used");
+    }
+
+    return check::result();
+}
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "expressions.hpp"
+#include "filter.hpp"
+#include "interval.hpp"
+#include "program.hpp"
+#include "random.hpp"
+
+// Every result `run` computes for variables within some bounds must lie in
+// what `bound` gives for them, and `filter` must select the rows evaluating
+// them one by one selects.
+using Interval = calc::Interval<double>;
+
+auto compile(std::string_view expression) {
+    return calc::compile<double>(expression.data(),
+                                 expression.data() + expression.size());
+}
+
+auto contains(Interval bounds, double x) -> bool {
+    return std::isnan(x) ? bounds.nan : bounds.lo <= x and x <= bounds.hi;
+}
+
+auto print(Interval x) -> std::string {
+    return '[' + std::to_string(x.lo) + ", " + std::to_string(x.hi) +
+           (x.nan ? ", nan]" : "]");
+}
+
+// Bounds of each variable, drawn now and then as a single integer or as an
+// interval around zero so that special arguments come up.
+auto box(std::size_t n, std::mt19937_64& engine) -> std::vector<Interval> {
+    std::uniform_real_distribution<double> distribution(-4, 4);
+    std::vector<Interval> slots(n);
+
+    for (auto&& slot : slots) {
+        const auto a = distribution(engine), b = distribution(engine);
+        switch (engine() % 4) {
+            case 0:
+                slot = {std::round(a), std::round(a)};
+                break;
+            case 1:
+                slot = {-std::abs(a), std::abs(b)};
+                break;
+            default:
+                slot = {std::min(a, b), std::max(a, b)};
+                break;
+        }
+    }
+    return slots;
+}
+
+auto within(std::string_view expression, std::mt19937_64& engine) -> void {
+    const auto program = compile(expression);
+    CHECK(program.has_value(), expression << " does not compile");
+    if (not program) {
+        return;
+    }
+
+    const auto slots = box(program->names.size(), engine);
+    const auto bounds =
+        calc::bound(*program, std::span<const Interval>(slots));
+    std::vector<double> values;
+
+    for (std::uint64_t i = 0; i < 50; ++i) {
+        std::vector<double> point(slots.size());
+        for (std::size_t slot = 0; slot < point.size(); ++slot) {
+            // the ends of the bounds as well as values between them
+            const auto [lo, hi, nan] = slots[slot];
+            const auto t = std::uniform_real_distribution<double>(0, 1)(engine);
+            point[slot] = i == 0   ? lo
+                          : i == 1 ? hi
+                                   : std::clamp(lo + t * (hi - lo), lo, hi);
+        }
+
+        const auto x = point.empty() ? 0 : point.front();
+        const auto result = calc::run(*program, std::span(point), values,
+                                      calc::Sample{5, i});
+
+        if (not contains(bounds, result)) {
+            CHECK(false, expression << " gives " << result << " at "
+                                    << program->names.front() << " = " << x
+                                    << ", outside " << print(bounds));
+            return;
+        }
+    }
+}
+
+// Whether a jump may skip an assignment, which batch mode rejects.
+auto conditional(const calc::Program<double>& program) -> bool {
+    std::uint32_t reach = 0;
+    for (std::uint32_t i = 0; i < program.code.size(); ++i) {
+        const auto& instruction = program.code[i];
+        if (calc::detail::is_jump(instruction.op)) {
+            reach = std::max(reach, instruction.b);
+        } else if (instruction.op == calc::Op::Store and i < reach) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the filter decided some block from its bounds.
+auto filter(std::string_view expression, std::mt19937_64& engine) -> bool {
+    const auto program = compile(expression);
+    if (not program or conditional(*program)) {
+        return true;
+    }
+
+    // runs of two blocks of one value, so that whole blocks can be decided,
+    // between runs of random values that are evaluated
+    constexpr std::size_t run = 2 * calc::batch_block;
+    constexpr std::size_t rows = 2 * run + 9;
+    std::vector<std::vector<double>> data(program->names.size(),
+                                          std::vector<double>(rows));
+    std::vector<const double*> columns;
+    std::uniform_real_distribution<double> distribution(-4, 4);
+
+    for (auto&& column : data) {
+        for (std::size_t row = 0; row < rows; ++row) {
+            if (row / run % 2 == 1) {
+                column[row] = distribution(engine);
+            } else if (row % run == 0) {
+                column[row] = distribution(engine);
+            } else {
+                column[row] = column[row - 1];
+            }
+        }
+        columns.push_back(column.data());
+    }
+
+    std::vector<std::size_t> selected;
+    const auto report = calc::filter(
+        *program, std::span<const double* const>(columns), rows, selected);
+    CHECK(report.has_value(), expression << " is rejected");
+    CHECK(not report or report->rejected + report->accepted +
+                                report->evaluated ==
+                            rows,
+          expression << " counts " << *report << " of " << rows << " rows");
+
+    std::vector<std::size_t> expected;
+    std::vector<double> slots(columns.size()), values;
+    for (std::size_t row = 0; row < rows; ++row) {
+        for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+            slots[slot] = data[slot][row];
+        }
+        if (calc::detail::truthy(calc::run(*program, std::span(slots),
+                                           values, calc::Sample{}))) {
+            expected.push_back(row);
+        }
+    }
+
+    CHECK(selected == expected, expression << " selects " << selected.size()
+                                           << " rows, expected "
+                                           << expected.size());
+    return report and report->rejected + report->accepted > 0;
+}
+
+auto main() -> int {
+    std::mt19937_64 engine(42);
+
+    for (int i = 0; i < 5000; ++i) {
+        within(check::expression(engine, 1 + i % 5), engine);
+    }
+
+    // blocks of equal values are decided unless the bounds lose the sign
+    // of a zero or a NaN, as in `x / 0 > y`
+    int undecided = 0;
+    for (int i = 0; i < 300; ++i) {
+        const auto predicate =
+            '(' + check::expression(engine, 1 + i % 4, false) + " > " +
+            check::expression(engine, 1 + i % 3, false) + ')';
+        undecided += not filter(predicate, engine);
+    }
+    CHECK(undecided < 6, undecided << " of 300 predicates decide no block");
+
+    for (const auto* expression : {
+             "x > y",
+             "and(x > 0, sin(y) < 0.5)",
+             "x % 3 > 1",
+             "xor(x, y) == 1",
+             "sqrt(x) + ln(y) > 1",
+             "if(x > y, x * x, y / 2) > 3",
+         }) {
+        CHECK(filter(expression, engine),
+              expression << " decides no block of equal values");
+    }
+
+    // pow(NaN, 0) and pow(1, NaN) are 1
+    for (const auto* expression : {"asin(x) ** y == 1", "y ** asin(x) == 1"}) {
+        const auto program = compile(expression);
+        const std::vector<Interval> slots = {{2, 3}, {0, 1}};
+        const auto truth = calc::detail::truthiness(
+            calc::bound(*program, std::span<const Interval>(slots)));
+        CHECK(truth.hi == 1, expression << " is never true");
+    }
+
+    // a variable reads what was last assigned to it, or either value when
+    // the assignment may be skipped
+    {
+        const std::vector<Interval> slots = {{1, 2}, {100, 100}};
+        const auto assigned = calc::bound(*compile("(w = x * 2) + w"),
+                                          std::span<const Interval>(slots));
+        // bounds are rounded outwards
+        CHECK(assigned.lo > 3.9 and assigned.hi < 8.1 and not assigned.nan,
+              "(w = x * 2) + w is within " << print(assigned));
+
+        const std::vector<Interval> signs = {{-1, 1}, {0, 0}};
+        const auto skipped = calc::bound(*compile("if(x > 0, w = 5, 1) + w"),
+                                         std::span<const Interval>(signs));
+        CHECK(skipped.lo <= 1 and skipped.hi >= 10,
+              "if(x > 0, w = 5, 1) + w is within " << print(skipped));
+    }
+
+    return check::result();
+}
@@ -0,0 +1,211 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "pipeline.hpp"
+#include "variables.hpp"
+
+// The queue must hand values over in order through many laps of its ring,
+// and `stream` must answer every line in input order however the lines are
+// split into batches.
+using namespace std::chrono_literals;
+
+auto queue() -> void {
+    constexpr int count = 100'000;
+    calc::SpscQueue<int, 4> queue;
+    std::vector<int> received;
+
+    {
+        std::jthread producer([&queue] {
+            for (int i = 0; i < count; ++i) {
+                queue.push(i);
+            }
+            queue.close();
+        });
+
+        while (auto value = queue.pop()) {
+            received.push_back(*value);
+        }
+    }
+
+    bool ordered = received.size() == count;
+    for (int i = 0; ordered and i < count; ++i) {
+        ordered = received[static_cast<std::size_t>(i)] == i;
+    }
+    CHECK(ordered, "values lost or reordered, " << received.size()
+                                                << " received");
+
+    // a closed queue refuses pushes and drains before it fails
+    calc::SpscQueue<int, 4> closed;
+    closed.push(1);
+    closed.close();
+    CHECK(not closed.push(2), "push after close accepted");
+    CHECK(closed.pop() == 1, "queued value lost on close");
+    CHECK(not closed.pop(), "pop after drain succeeded");
+}
+
+auto numbers(int n) -> calc::Generator<int> {
+    for (int i = 0; i < n; ++i) {
+        co_yield i;
+    }
+    throw std::runtime_error("done");
+}
+
+auto generator() -> void {
+    int next = 0;
+    bool thrown = false;
+    try {
+        for (auto&& value : numbers(5)) {
+            CHECK(value == next, "generator yields " << value);
+            ++next;
+        }
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(next == 5 and thrown, "generator stopped at " << next);
+}
+
+auto results(const std::string& text, std::size_t lines)
+    -> std::vector<std::optional<double>> {
+    std::istringstream input(text);
+    calc::Variables<double, const char*> vars;
+    std::vector<std::optional<double>> out;
+    for (auto&& result : calc::stream<double>(input, vars, lines)) {
+        out.push_back(result);
+    }
+    return out;
+}
+
+auto ordering() -> void {
+    // valid, invalid and undefined lines mixed, with blank lines skipped
+    std::string text = "x = 2\n";
+    std::vector<std::optional<double>> expected = {2};
+    for (int i = 1; i < 300; ++i) {
+        switch (i % 3) {
+            case 0:
+                text += "x * " + std::to_string(i) + "\n\n";
+                expected.push_back(2 * i);
+                break;
+            case 1:
+                text += std::to_string(i) + " +\n";
+                expected.push_back(std::nullopt);
+                break;
+            default:
+                text += "y\n";
+                expected.push_back(std::nullopt);
+                break;
+        }
+    }
+
+    for (const std::size_t lines : {1, 3, 256}) {
+        CHECK(results(text, lines) == expected,
+              "results out of order with " << lines << " lines per batch");
+    }
+}
+
+// Input that blocks like a terminal until text is fed or it is ended.
+class Terminal : public std::streambuf {
+   public:
+    auto feed(const std::string& text) -> void {
+        {
+            std::lock_guard lock(_mutex);
+            _pending += text;
+        }
+        _changed.notify_all();
+    }
+
+    auto end() -> void {
+        {
+            std::lock_guard lock(_mutex);
+            _ended = true;
+        }
+        _changed.notify_all();
+    }
+
+   protected:
+    auto underflow() -> int_type override {
+        std::unique_lock lock(_mutex);
+        _changed.wait(lock, [this] { return not _pending.empty() or _ended; });
+        if (_pending.empty()) {
+            return traits_type::eof();
+        }
+        _current = _pending[0];
+        _pending.erase(0, 1);
+        setg(&_current, &_current, &_current + 1);
+        return traits_type::to_int_type(_current);
+    }
+
+   private:
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::string _pending;
+    char _current = 0;
+    bool _ended = false;
+};
+
+auto shutdown() -> void {
+    // a consumer leaving early stops the stages without reading the rest
+    {
+        std::string text;
+        for (int i = 0; i < 100'000; ++i) {
+            text += "1 + 1\n";
+        }
+        std::istringstream input(text);
+        calc::Variables<double, const char*> vars;
+        int seen = 0;
+        for (auto&& result : calc::stream<double>(input, vars, 16)) {
+            if (++seen == 10 or not result) {
+                break;
+            }
+        }
+        CHECK(seen == 10, "stopped after " << seen);
+    }
+
+    // while the lexer waits for a line, leaving waits for that line only
+    {
+        Terminal terminal;
+        std::istream input(&terminal);
+        calc::Variables<double, const char*> vars;
+        std::optional<calc::Generator<std::optional<double>>> results;
+        results.emplace(calc::stream<double>(input, vars, 1));
+
+        terminal.feed("2 * 3\n");
+        auto it = results->begin();
+        CHECK(*it == 6.0, "first line not answered");
+
+        std::atomic<bool> stopped = false;
+        std::jthread leave([&] {
+            results.reset();
+            stopped = true;
+        });
+
+        std::this_thread::sleep_for(100ms);
+        CHECK(not stopped, "stopped while a read was in progress");
+
+        terminal.feed("4\n");
+        for (int i = 0; i < 500 and not stopped; ++i) {
+            std::this_thread::sleep_for(10ms);
+        }
+        CHECK(stopped, "still waiting after the next line");
+        terminal.end();
+    }
+}
+
+auto main() -> int {
+    queue();
+    generator();
+    ordering();
+    shutdown();
+
+    return check::result();
+}
@@ -0,0 +1,89 @@
+#include <cmath>
+#include <string_view>
+
+#include "check.hpp"
+#include "evaluator.hpp"
+#include "program.hpp"
+#include "variables.hpp"
+
+// Compiled programs must give what the token evaluator gives.
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+auto variables() -> calc::Variables<double, const char*> {
+    calc::Variables<double, const char*> vars;
+    vars.set("x", 2.5).set("y", -1.5).set("z", 4);
+    return vars;
+}
+
+auto compare(std::string_view expression) -> void {
+    const auto* begin = expression.data();
+    const auto* end = begin + expression.size();
+
+    auto tokens = variables();
+    const auto expected = calc::evaluate<double>(begin, end, tokens);
+
+    const auto program = calc::compile<double>(begin, end);
+    CHECK(expected.has_value(), expression << " does not evaluate");
+    CHECK(program.has_value(), expression << " does not compile");
+    if (not program or not expected) {
+        return;
+    }
+
+    auto compiled = variables();
+    const auto result = calc::evaluate(*program, compiled);
+
+    CHECK(result and same(*result, *expected),
+          expression << " gives " << result.value_or(NAN) << ", expected "
+                     << *expected);
+}
+
+auto main() -> int {
+    for (const auto* expression : {
+             "x + y * z",
+             "x ** 2 - z / y",
+             "sqrt(z) + sin(x) * cos(y)",
+             "min(x, y) + max(y, z) % 3",
+             "if(x > y, x, y) + if(y > z, 1, 2)",
+             "and(x, y) + or(0, z) * 2",
+             "xor(4, 2)",
+             "xor(x, z)",
+             "xor(z, 4)",
+             "xor(y, 0.5)",
+             "gcd(12, 18) + lcm(4, 6)",
+             "ln(y)",
+             "(w = x * 2) + w",
+             "(w = 3) * x + w",
+         }) {
+        compare(expression);
+    }
+
+    // an assignment that may be skipped does not define the variable
+    {
+        const std::string_view expression = "if(x > z, w = 1, 2) + w";
+        auto vars = variables();
+        const auto program = calc::compile<double>(
+            expression.data(), expression.data() + expression.size());
+        CHECK(program and not calc::evaluate(*program, vars),
+              "undefined w accepted");
+    }
+
+    // the operand `and` and `or` do not need and the branch `if` does not
+    // take are skipped, assignments in them included
+    for (const auto* expression : {
+             "and(x < 0, w = 5)",
+             "or(x > 0, w = 5)",
+             "if(x > 0, 1, w = 5)",
+             "if(x < 0, w = 5, 2) + and(0, w = 6) * or(1, w = 7)",
+         }) {
+        auto vars = variables();
+        const auto program = calc::compile<double>(
+            expression, expression + std::string_view(expression).size());
+        const auto result = calc::evaluate(*program, vars);
+        CHECK(result and not vars.get("w"),
+              expression << " ran a skipped assignment");
+    }
+
+    return check::result();
+}
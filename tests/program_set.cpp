@@ -0,0 +1,73 @@
+#include <cmath>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "program.hpp"
+#include "program_set.hpp"
+#include "variables.hpp"
+
+// A set must give what compiling and evaluating its expressions one after
+// the other gives, with the assignments of each visible to the next.
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+auto variables(double x) -> calc::Variables<double, const char*> {
+    calc::Variables<double, const char*> vars;
+    vars.set("x", x).set("y", 2.5).set("z", -4);
+    return vars;
+}
+
+auto compare(std::vector<std::string_view> expressions, double x) -> void {
+    const auto set = calc::compile_set<double>(expressions);
+    CHECK(set.has_value(), expressions.front() << "... does not compile");
+    if (not set) {
+        return;
+    }
+
+    auto together = variables(x);
+    std::vector<double> out(expressions.size());
+    CHECK(calc::evaluate(*set, together, std::span(out)),
+          expressions.front() << "... does not evaluate");
+
+    auto apart = variables(x);
+    for (std::size_t i = 0; i < expressions.size(); ++i) {
+        const auto program = calc::compile<double>(
+            expressions[i].data(),
+            expressions[i].data() + expressions[i].size());
+        const auto expected = calc::evaluate(*program, apart);
+
+        CHECK(expected and same(out[i], *expected),
+              expressions[i] << " at x = " << x << " gives " << out[i]
+                             << " in a set, alone "
+                             << expected.value_or(NAN));
+    }
+
+    for (const auto* name : {"x", "y", "z", "w"}) {
+        CHECK(together.get(name) == apart.get(name),
+              name << " differs after the set");
+    }
+}
+
+auto main() -> int {
+    const std::vector<std::vector<std::string_view>> sets = {
+        {"x + y", "x * y", "sqrt(x * x + y * y)"},
+        {"sin(x) * 2", "sin(x) + cos(x)", "sin(x)"},
+        // a value shared with a branch that may be skipped
+        {"if(x > 0, y * z, 1)", "y * z + 1"},
+        {"and(x > 0, ln(y) > 0)", "ln(y)", "or(x > 0, ln(y))"},
+        // assignments reach the expressions after them
+        {"w = x * 2", "w + y", "(w = w + 1) * z", "w"},
+        {"x = x + 1", "x * x", "x"},
+        {"if(x > 0, y, z) * 3", "if(x > 0, y, z)", "min(x, y)"},
+    };
+
+    for (auto&& set : sets) {
+        for (const auto x : {-1.5, 0.0, 3.0}) {
+            compare(set, x);
+        }
+    }
+
+    return check::result();
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "monte_carlo.hpp"
+#include "program.hpp"
+#include "random.hpp"
+
+// Philox must match the known answers of its authors, the builtins must
+// follow their distributions, and Monte Carlo summaries must not depend on
+// how the samples are split across threads.
+using Words = std::array<std::uint32_t, 4>;
+
+auto philox(Words counter, std::array<std::uint32_t, 2> key, Words expected)
+    -> void {
+    const auto result = calc::detail::philox(counter, key);
+    CHECK(result == expected, std::hex << "philox(" << counter[0] << ", "
+                                       << key[0] << ") gives " << result[0]
+                                       << ' ' << result[1] << ' '
+                                       << result[2] << ' ' << result[3]);
+}
+
+// Checks the mean, the variance and the Kolmogorov-Smirnov distance to
+// `cdf` of `values`. The bounds are five standard errors for the moments
+// and the 0.1% critical value of the distance.
+auto distribution(std::string_view name, std::vector<double> values,
+                  double mean, double variance, double kurtosis,
+                  const std::function<double(double)>& cdf) -> void {
+    const auto n = static_cast<double>(values.size());
+
+    double sum = 0;
+    for (const auto value : values) {
+        sum += value;
+    }
+    const auto sample_mean = sum / n;
+
+    double squares = 0;
+    for (const auto value : values) {
+        squares += (value - sample_mean) * (value - sample_mean);
+    }
+    const auto sample_variance = squares / (n - 1);
+
+    CHECK(std::abs(sample_mean - mean) < 5 * std::sqrt(variance / n),
+          name << " has mean " << sample_mean << ", expected " << mean);
+    CHECK(std::abs(sample_variance - variance) <
+              5 * variance * std::sqrt((kurtosis - 1) / n),
+          name << " has variance " << sample_variance << ", expected "
+               << variance);
+
+    std::ranges::sort(values);
+    double distance = 0;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        const auto p = cdf(values[i]);
+        distance = std::max({distance, static_cast<double>(i + 1) / n - p,
+                             p - static_cast<double>(i) / n});
+    }
+    CHECK(distance < 1.95 / std::sqrt(n),
+          name << " is " << distance << " from its distribution");
+}
+
+auto compile(std::string_view expression) {
+    return *calc::compile<double>(expression.data(),
+                                  expression.data() + expression.size());
+}
+
+auto main() -> int {
+    // Random123 known answers for philox4x32_10
+    philox({0, 0, 0, 0}, {0, 0},
+           {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+    philox({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+           {0xffffffff, 0xffffffff},
+           {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+    philox({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+           {0xa4093822, 0x299f31d0},
+           {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+
+    // uniform numbers stay in [0, 1) and streams differ
+    {
+        std::size_t outside = 0, shared = 0;
+        for (std::uint64_t index = 0; index < 100'000; ++index) {
+            const calc::Sample sample{3, index};
+            const auto u = calc::uniform<double>(sample, 0);
+            outside += not(u >= 0 and u < 1);
+            shared += u == calc::uniform<double>(sample, 1);
+        }
+        CHECK(outside == 0, outside << " uniform numbers outside [0, 1)");
+        CHECK(shared == 0, shared << " numbers shared by two streams");
+    }
+
+    // uniform and normal numbers follow their distributions
+    {
+        constexpr std::size_t n = 200'000;
+        std::vector<double> uniform(n), normal(n);
+        for (std::uint64_t index = 0; index < n; ++index) {
+            const calc::Sample sample{11, index};
+            uniform[index] = calc::uniform<double>(sample, 0);
+            normal[index] = calc::normal<double>(sample, 1, 2, 3);
+        }
+
+        distribution("rand()", uniform, 0.5, 1.0 / 12, 1.8,
+                     [](double x) { return std::clamp(x, 0.0, 1.0); });
+        distribution("normal(2, 3)", normal, 2, 9, 3, [](double x) {
+            return std::erfc(-(x - 2) / 3 / std::sqrt(2.0)) / 2;
+        });
+    }
+
+    // quantiles are exact while every result is kept
+    {
+        const auto program = compile("rand()");
+        const auto summary = calc::monte_carlo(program, 1001, 1, 3);
+
+        std::vector<double> values(1001);
+        for (std::uint64_t index = 0; index < values.size(); ++index) {
+            values[index] = calc::uniform<double>({3, index}, 0);
+        }
+        std::ranges::sort(values);
+
+        CHECK(summary and summary->quantiles[3] == values[500] and
+                  summary->quantiles[0] == values[10] and
+                  summary->min == values.front() and
+                  summary->max == values.back(),
+              "quantiles of 1001 samples are not exact");
+    }
+
+    // and within five standard errors of their level beyond
+    {
+        const auto program = compile("normal(0, 1)");
+        const auto summary = calc::monte_carlo(program, 1'000'000, 2, 5);
+        CHECK(summary, "monte carlo of normal(0, 1) failed");
+
+        for (std::size_t i = 0; summary and i < summary->quantiles.size();
+             ++i) {
+            const auto level = calc::monte_carlo_levels[i];
+            const auto reached =
+                std::erfc(-summary->quantiles[i] / std::sqrt(2.0)) / 2;
+            CHECK(std::abs(reached - level) <
+                      5 * std::sqrt(level * (1 - level) /
+                                    calc::monte_carlo_kept),
+                  "quantile " << level << " of normal(0, 1) is "
+                              << summary->quantiles[i]);
+        }
+    }
+
+    // programs batch mode rejects are evaluated a sample at a time
+    {
+        const auto program = compile("if(rand() > 0.25, w = 1, 3)");
+        const auto summary = calc::monte_carlo(program, 10'000, 2, 4);
+
+        std::size_t ones = 0;
+        for (std::uint64_t index = 0; index < 10'000; ++index) {
+            ones += calc::uniform<double>({4, index}, 0) > 0.25;
+        }
+        const auto mean = (ones + 3.0 * (10'000 - ones)) / 10'000;
+
+        CHECK(summary and std::abs(summary->mean - mean) < 1e-12 and
+                  summary->min == 1 and summary->max == 3,
+              "monte carlo of a conditional assignment has mean "
+                  << (summary ? summary->mean : NAN) << ", expected "
+                  << mean);
+    }
+
+    // the same summary for any number of threads, another for another seed
+    {
+        const auto program = compile("rand() * normal(2, 3) + rand()");
+        const auto one = calc::monte_carlo(program, 100'003, 1, 7);
+        CHECK(one and one->samples == 100'003, "monte carlo failed");
+
+        for (const std::size_t jobs : {2, 3, 8}) {
+            const auto many = calc::monte_carlo(program, 100'003, jobs, 7);
+            CHECK(many and one and many->mean == one->mean and
+                      many->variance == one->variance and
+                      many->min == one->min and many->max == one->max and
+                      many->quantiles == one->quantiles,
+                  "monte carlo on " << jobs << " threads differs");
+        }
+
+        const auto other = calc::monte_carlo(program, 100'003, 1, 8);
+        CHECK(other and one and other->mean != one->mean,
+              "seed 8 gives the summary of seed 7");
+    }
+
+    return check::result();
+}
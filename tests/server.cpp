@@ -0,0 +1,155 @@
+#include "check.hpp"
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "server.hpp"
+
+using namespace std::chrono_literals;
+
+auto connect(const std::string& path) -> int {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::ranges::copy(path, address.sun_path);
+
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address),
+                      sizeof(address)) == 0) {
+            return fd;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    ::close(fd);
+    return -1;
+}
+
+auto send(int fd, std::string_view data) -> void {
+    while (not data.empty()) {
+        const auto size = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (size <= 0) {
+            return;
+        }
+        data.remove_prefix(static_cast<std::size_t>(size));
+    }
+}
+
+// Reads until `lines` answers arrived or the server closed the connection.
+auto receive(int fd, std::size_t lines) -> std::string {
+    std::string result;
+    char buffer[4096];
+
+    while (static_cast<std::size_t>(std::ranges::count(result, '\n')) <
+           lines) {
+        const auto size = ::read(fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            break;
+        }
+        result.append(buffer, static_cast<std::size_t>(size));
+    }
+    return result;
+}
+
+auto open_files() -> std::size_t {
+    return static_cast<std::size_t>(std::distance(
+        std::filesystem::directory_iterator("/proc/self/fd"),
+        std::filesystem::directory_iterator{}));
+}
+
+auto main() -> int {
+    const auto path = (std::filesystem::temp_directory_path() /
+                       ("calculator-test-" + std::to_string(::getpid())))
+                          .string();
+
+    calc::Server<double> server(path);
+    std::atomic<bool> stop = false;
+    std::jthread loop([&]() { server.run(stop); });
+
+    // answers come in order and assignments are shared between connections
+    {
+        const auto first = connect(path);
+        send(first, "x = 3\n2 * x\n$5\nx + 1\n");
+        const auto answers = receive(first, 3);
+        CHECK(answers == "= 3\n= 6\n= 4\n", answers);
+        ::close(first);
+
+        const auto second = connect(path);
+        send(second, "x * 5\nnope(\n");
+        const auto more = receive(second, 2);
+        CHECK(more == "= 15\n! invalid expression\n", more);
+        ::close(second);
+    }
+
+    // a request the server refuses is answered after those sent before it
+    {
+        const auto fd = connect(path);
+        send(fd, "1 + 2\n2 * 2\n$99999999999\n5\n");
+        const auto answers = receive(fd, 4);
+        CHECK(answers == "= 3\n= 4\n! malformed or oversized request\n",
+              answers);
+        ::close(fd);
+    }
+
+    std::this_thread::sleep_for(300ms);
+    CHECK(server.variables().get("x") == 3.0, "assignment not published");
+
+    // clients that hang up without reading their answers, one of them
+    // with more answers than a socket buffer holds, must not keep their
+    // connection open
+    const auto baseline = open_files();
+    {
+        std::string flood;
+        for (int i = 0; i < 100'000; ++i) {
+            flood += "1 + 1\n";
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            const auto fd = connect(path);
+            send(fd, i == 0 ? std::string_view(flood) : "2 + 2\n");
+            ::close(fd);
+        }
+
+        const auto fd = connect(path);
+        send(fd, "3 * 3\n");
+        ::shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+    }
+
+    for (int i = 0; i < 200 and open_files() > baseline; ++i) {
+        std::this_thread::sleep_for(10ms);
+    }
+    CHECK(open_files() == baseline,
+          open_files() - baseline << " connections leaked");
+
+    // still serving
+    {
+        const auto fd = connect(path);
+        send(fd, "1 + 2\n");
+        const auto answer = receive(fd, 1);
+        CHECK(answer == "= 3\n", answer);
+        ::close(fd);
+    }
+
+    stop = true;
+    loop.join();
+
+    return check::result();
+}
+
+#else
+
+auto main() -> int { return check::result(); }
+
+#endif
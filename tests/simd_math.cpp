@@ -0,0 +1,229 @@
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "simd_math.hpp"
+
+#ifdef CALC_SIMD
+
+namespace simd = calc::simd;
+
+// Sweeps the `Fast` kernels against long double libm, which rounds to the
+// nearest double almost always, and checks the errors documented with
+// `MathMode`. Special values must match double libm exactly.
+constexpr std::size_t sweep = 200'000;
+
+// Distance in representable doubles, with -0 and +0 next to each other.
+auto ulps(double a, double b) -> double {
+    const auto order = [](double x) {
+        const auto bits = std::bit_cast<std::int64_t>(x);
+        return bits < 0 ? INT64_MIN - bits : bits;
+    };
+    const auto x = order(a), y = order(b);
+    return static_cast<double>(x > y ? static_cast<std::uint64_t>(x) -
+                                           static_cast<std::uint64_t>(y)
+                                     : static_cast<std::uint64_t>(y) -
+                                           static_cast<std::uint64_t>(x));
+}
+
+auto same(double a, double b) -> bool {
+    return std::bit_cast<std::uint64_t>(a) == std::bit_cast<std::uint64_t>(b) or
+           (std::isnan(a) and std::isnan(b));
+}
+
+using Unary = void (*)(const double*, double*, std::size_t);
+using Binary = void (*)(const double*, const double*, double*, std::size_t);
+
+// Both instruction sets the batch kernels dispatch to, where the CPU has them.
+template <class Kernel>
+auto unary_kernels() -> std::vector<Unary> {
+    std::vector<Unary> kernels{&simd::detail::map<Kernel, simd::detail::vec2>};
+    if (simd::detail::has_avx2()) {
+        kernels.push_back(&simd::detail::map_avx2<Kernel>);
+    }
+    return kernels;
+}
+
+template <class Kernel>
+auto binary_kernels() -> std::vector<Binary> {
+    std::vector<Binary> kernels{&simd::detail::map<Kernel, simd::detail::vec2>};
+    if (simd::detail::has_avx2()) {
+        kernels.push_back(&simd::detail::map_avx2<Kernel>);
+    }
+    return kernels;
+}
+
+template <class Kernel, class Reference, class Exact, class Bound>
+auto sweep_unary(const char* name, const std::vector<double>& in,
+                 const std::vector<double>& special, Reference reference,
+                 Exact exact, Bound bound) -> void {
+    std::vector<double> out(in.size());
+
+    for (auto kernel : unary_kernels<Kernel>()) {
+        kernel(in.data(), out.data(), in.size());
+
+        // worst error relative to the bound
+        double worst = 0, at = 0;
+        for (std::size_t i = 0; i < in.size(); ++i) {
+            const auto expected =
+                static_cast<double>(reference(static_cast<long double>(in[i])));
+            const auto ratio = ulps(out[i], expected) / bound(in[i]);
+            if (not(ratio <= worst)) {
+                worst = ratio;
+                at = in[i];
+            }
+        }
+        CHECK(worst <= 1, name << '(' << at << ") is " << worst * bound(at)
+                               << " ulp off, more than " << bound(at));
+
+        kernel(special.data(), out.data(), special.size());
+        for (std::size_t i = 0; i < special.size(); ++i) {
+            CHECK(same(out[i], exact(special[i])),
+                  name << '(' << special[i] << ") gives " << out[i]
+                       << ", libm gives " << exact(special[i]));
+        }
+    }
+}
+
+auto uniform(double lo, double hi) -> std::vector<double> {
+    std::mt19937_64 engine(42);
+    std::uniform_real_distribution<double> distribution(lo, hi);
+    std::vector<double> values(sweep);
+    for (auto&& value : values) {
+        value = distribution(engine);
+    }
+    return values;
+}
+
+// Every binade between 2^lo and 2^hi gets the same share.
+auto logarithmic(int lo, int hi) -> std::vector<double> {
+    std::mt19937_64 engine(42);
+    std::uniform_real_distribution<double> distribution(lo, hi);
+    std::vector<double> values(sweep);
+    for (auto&& value : values) {
+        value = std::exp2(distribution(engine));
+    }
+    return values;
+}
+
+auto main() -> int {
+    const auto inf = HUGE_VAL;
+    const auto nan = NAN;
+
+    sweep_unary<simd::detail::Exp>(
+        "exp", uniform(-745, 709.7),
+        {0.0, -0.0, inf, -inf, nan, 709.8, 1000, -745.2, -1000, 5e-324,
+         -5e-324, 1e-300},
+        [](long double x) { return std::exp(x); },
+        [](double x) { return std::exp(x); }, [](double) { return 1.0; });
+
+    sweep_unary<simd::detail::Ln>(
+        "ln", logarithmic(-1074, 1024),
+        {0.0, -0.0, -1, -inf, inf, nan, 1, 5e-324, DBL_MIN, DBL_MAX},
+        [](long double x) { return std::log(x); },
+        [](double x) { return std::log(x); }, [](double) { return 1.0; });
+
+    // near 1 the result cancels to its last bits
+    sweep_unary<simd::detail::Ln>(
+        "ln", uniform(0.5, 2), {}, [](long double x) { return std::log(x); },
+        [](double x) { return std::log(x); }, [](double) { return 1.0; });
+
+    const auto trigonometric = [](double x) {
+        return std::abs(x) < 10 ? 2.0 : std::abs(x) < 8e5 ? 3.0 : 1.0;
+    };
+
+    for (const auto& in : {uniform(-10, 10), uniform(-8e5, 8e5)}) {
+        sweep_unary<simd::detail::Sin>(
+            "sin", in, {0.0, -0.0, inf, -inf, nan, 8e5, 1e22, DBL_MAX, 5e-324},
+            [](long double x) { return std::sin(x); },
+            [](double x) { return std::sin(x); }, trigonometric);
+
+        sweep_unary<simd::detail::Cos>(
+            "cos", in, {0.0, -0.0, inf, -inf, nan, 8e5, 1e22, DBL_MAX, 5e-324},
+            [](long double x) { return std::cos(x); },
+            [](double x) { return std::cos(x); }, trigonometric);
+    }
+
+    sweep_unary<simd::detail::Tanh>(
+        "tanh", uniform(-25, 25),
+        {0.0, -0.0, inf, -inf, nan, 22, -22, 1e-300, -1e-300, 5e-324},
+        [](long double x) { return std::tanh(x); },
+        [](double x) { return std::tanh(x); }, [](double) { return 3.0; });
+
+    sweep_unary<simd::detail::Tanh>(
+        "tanh", logarithmic(-60, 2), {},
+        [](long double x) { return std::tanh(x); },
+        [](double x) { return std::tanh(x); }, [](double) { return 3.0; });
+
+    // pow against powl for x over every binade and y keeping the result
+    // finite, then special values against pow
+    {
+        std::mt19937_64 engine(42);
+        std::uniform_real_distribution<double> exponent(-1000, 1000);
+        std::uniform_real_distribution<double> fraction(-1, 1);
+
+        std::vector<double> x(sweep), y(sweep), out(sweep);
+        for (std::size_t i = 0; i < sweep; ++i) {
+            x[i] = std::exp2(exponent(engine));
+            y[i] = fraction(engine) * 700 / std::abs(std::log(x[i]));
+        }
+        for (std::size_t i = 0; i < sweep / 4; ++i) {
+            y[i] = std::round(y[i]);
+        }
+
+        const std::vector<std::pair<double, double>> special = {
+            {0.0, 2},   {0.0, -1},  {-0.0, 3},  {-2, 3},   {-2, 0.5},
+            {-8, 1.0 / 3},          {inf, -1},  {-inf, 3}, {1, nan},
+            {nan, 0},   {nan, 1},   {2, inf},   {0.5, inf}, {2, -inf},
+            {1, inf},   {-1, inf},  {2, 1024},  {2, -1080}, {10, 400},
+            {DBL_MAX, 2},           {2, -1074}, {0.5, 1075}};
+        std::vector<double> sx, sy, sout(special.size());
+        for (auto&& [a, b] : special) {
+            sx.push_back(a);
+            sy.push_back(b);
+        }
+
+        for (auto kernel : binary_kernels<simd::detail::Pow>()) {
+            kernel(x.data(), y.data(), out.data(), sweep);
+
+            std::size_t wrong = 0;
+            for (std::size_t i = 0; i < sweep; ++i) {
+                const auto expected = static_cast<double>(
+                    std::pow(static_cast<long double>(x[i]),
+                             static_cast<long double>(y[i])));
+                const auto bound =
+                    2 * (1 + std::abs(y[i] * std::log(x[i])));
+                if (not(ulps(out[i], expected) <= bound)) {
+                    if (wrong++ == 0) {
+                        std::cerr << "pow(" << x[i] << ", " << y[i]
+                                  << ") is " << ulps(out[i], expected)
+                                  << " ulp off\n";
+                    }
+                }
+            }
+            CHECK(wrong == 0, "pow exceeds its bound " << wrong << " times");
+
+            kernel(sx.data(), sy.data(), sout.data(), special.size());
+            for (std::size_t i = 0; i < special.size(); ++i) {
+                const auto expected = std::pow(sx[i], sy[i]);
+                CHECK(same(sout[i], expected),
+                      "pow(" << sx[i] << ", " << sy[i] << ") gives "
+                             << sout[i] << ", libm gives " << expected);
+            }
+        }
+    }
+
+    return check::result();
+}
+
+#else
+
+auto main() -> int { return check::result(); }
+
+#endif
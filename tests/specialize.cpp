@@ -0,0 +1,89 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "expressions.hpp"
+#include "program.hpp"
+#include "variables.hpp"
+
+// A program specialized on some variables must give what the program gives
+// with those variables set, and assign the same values.
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+auto variables() -> calc::Variables<double, const char*> {
+    calc::Variables<double, const char*> vars;
+    vars.set("x", 2.5).set("y", -1.5).set("z", 4).set("w", 0.5);
+    return vars;
+}
+
+auto compile(std::string_view expression) {
+    return calc::compile<double>(expression.data(),
+                                 expression.data() + expression.size());
+}
+
+auto compare(const std::string& expression) -> void {
+    const auto program = compile(expression);
+    CHECK(program.has_value(), expression << " does not compile");
+    if (not program) {
+        return;
+    }
+
+    // w is bound too, though the expressions may assign it
+    const auto residual = calc::specialize(
+        *program, {{"x", 2.5}, {"y", -1.5}, {"w", 0.5}});
+
+    auto expected_vars = variables();
+    auto residual_vars = variables();
+    const auto expected = calc::evaluate(*program, expected_vars);
+    const auto result = calc::evaluate(residual, residual_vars);
+
+    CHECK(result and expected and same(*result, *expected),
+          expression << " gives " << result.value_or(NAN) << ", expected "
+                     << expected.value_or(NAN));
+    CHECK(same(*residual_vars.get("w"), *expected_vars.get("w")),
+          expression << " assigns w = " << *residual_vars.get("w")
+                     << ", expected " << *expected_vars.get("w"));
+}
+
+auto main() -> int {
+    std::mt19937_64 engine(7);
+
+    for (int i = 0; i < 3000; ++i) {
+        compare(check::expression(engine, 1 + i % 5, false));
+    }
+
+    // loads before an assignment read the bound value, the ones after it
+    // the assigned one
+    {
+        const auto program = compile("sin(a) * x + (a = x) + a");
+        const auto residual = calc::specialize(*program, {{"a", 2}});
+
+        calc::Variables<double, const char*> vars;
+        vars.set("x", 3);
+        const auto result = calc::evaluate(residual, vars);
+        CHECK(result == std::sin(2.0) * 3 + 3 + 3,
+              "sin(a) * x + (a = x) + a gives " << result.value_or(NAN));
+        CHECK(vars.get("a") == 3.0, "assignment to a lost");
+    }
+
+    // everything that depends only on bound variables is computed
+    {
+        const auto program = compile("if(a > 1, sin(a) * x, cos(a)) + b");
+        const auto residual = calc::specialize(*program, {{"a", 2}, {"b", 1}});
+
+        CHECK(residual.names.size() == 1 and residual.names[0] == "x",
+              residual.names.size() << " variables left");
+        bool sin = false;
+        for (auto&& instruction : residual.code) {
+            sin = sin or instruction.op == calc::Op::Sin or
+                  instruction.op == calc::Op::Cos;
+        }
+        CHECK(not sin, "sin(a) or cos(a) left in the residual program");
+    }
+
+    return check::result();
+}
@@ -0,0 +1,113 @@
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "expressions.hpp"
+#include "program.hpp"
+#include "random.hpp"
+#include "variables.hpp"
+#include "vm.hpp"
+
+// The VM must give what the program interpreter gives, random builtins
+// included, and publish the same assignments when it evaluates.
+auto same(double a, double b) -> bool {
+    return a == b or (std::isnan(a) and std::isnan(b));
+}
+
+auto compare(const std::string& expression, std::mt19937_64& engine) -> void {
+    const auto program = calc::compile<double>(
+        expression.data(), expression.data() + expression.size());
+    CHECK(program.has_value(), expression << " does not compile");
+    if (not program) {
+        return;
+    }
+
+    const auto vm = calc::assemble(*program);
+    CHECK(vm.has_value(), expression << " does not assemble");
+    if (not vm) {
+        return;
+    }
+
+    std::uniform_real_distribution<double> distribution(-4, 4);
+    std::vector<double> values;
+
+    for (std::uint64_t i = 0; i < 20; ++i) {
+        std::vector<double> slots(program->names.size());
+        for (auto&& slot : slots) {
+            slot = i % 4 == 0 ? std::round(distribution(engine))
+                              : distribution(engine);
+        }
+        auto registers = slots;
+
+        const calc::Sample sample{11, i};
+        const auto expected =
+            calc::run(*program, std::span(slots), values, sample);
+        const auto result = calc::run(*vm, std::span(registers), sample);
+
+        if (not same(result, expected)) {
+            CHECK(false, expression << " gives " << result
+                                    << ", the interpreter " << expected);
+            return;
+        }
+    }
+}
+
+auto main() -> int {
+    std::mt19937_64 engine(42);
+
+    for (int i = 0; i < 3000; ++i) {
+        compare(check::expression(engine, 1 + i % 5), engine);
+    }
+
+    for (const auto* expression : {
+             "x * y + z",
+             "z + x * y",
+             "if(x > 0, y * 2, z) + w",
+             "and(x, y) + or(z, 0)",
+             "(w = x * y) + w * z",
+             "rand() + normal(x, 2) * rand()",
+         }) {
+        compare(expression, engine);
+    }
+
+    // evaluation publishes what the interpreter publishes, programs with
+    // assignments a jump can skip are left to the interpreter
+    for (const auto* expression : {
+             "(w = x * y) + w * z",
+             "x + (x = 3) * x",
+             "(w = 1) + (w = w + 2) + w",
+             "if(x > 0, w = 1, 2) + x",
+             "if(x < 0, w = 1, 2) + x",
+         }) {
+        const auto program = calc::compile<double>(
+            expression, expression + std::string_view(expression).size());
+        const auto vm = calc::assemble(*program);
+
+        calc::Variables<double, const char*> expected_vars, vars;
+        expected_vars.set("x", 1.5).set("y", 2).set("z", -3);
+        vars.set("x", 1.5).set("y", 2).set("z", -3);
+
+        const auto expected = calc::evaluate(*program, expected_vars);
+        const auto result = calc::evaluate(*program, vm, vars);
+
+        CHECK(vm and result == expected and
+                  vars.get("x") == expected_vars.get("x") and
+                  vars.get("w") == expected_vars.get("w"),
+              expression << " gives " << result.value_or(NAN) << ", w = "
+                         << vars.get("w").value_or(NAN) << " on the VM");
+    }
+
+    // a random stream that does not fit the VM instruction
+    {
+        calc::Program<double> program;
+        program.code.push_back({calc::Op::Rand, 0, 0, 70'000, 0});
+        CHECK(not calc::assemble(program), "stream 70000 accepted");
+    }
+
+    return check::result();
+}